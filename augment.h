@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+namespace intrusive_map {
+// Аугментация дерева: каждая вершина хранит агрегат моноида по значениям
+// противоположной стороны во всем своем поддереве (для левого дерева — по
+// right). Политика задает
+//   using value_t;
+//   static value_t identity();                       // нейтральный элемент
+//   static value_t lift(V const& v);                 // значение одной пары
+//   static value_t combine(value_t a, value_t b);    // ассоциативная операция
+// combine применяется в порядке ключей, так что коммутативность не нужна
+
+// Агрегаты не хранятся
+struct no_augment {};
+
+template <typename T>
+struct sum_augment {
+  using value_t = T;
+  static value_t identity() {
+    return T();
+  }
+  static value_t lift(T const& v) {
+    return v;
+  }
+  static value_t combine(value_t const& a, value_t const& b) {
+    return a + b;
+  }
+};
+
+template <typename T>
+struct min_augment {
+  using value_t = T;
+  static value_t identity() {
+    return std::numeric_limits<T>::max();
+  }
+  static value_t lift(T const& v) {
+    return v;
+  }
+  static value_t combine(value_t const& a, value_t const& b) {
+    return std::min(a, b);
+  }
+};
+
+template <typename T>
+struct max_augment {
+  using value_t = T;
+  static value_t identity() {
+    return std::numeric_limits<T>::lowest();
+  }
+  static value_t lift(T const& v) {
+    return v;
+  }
+  static value_t combine(value_t const& a, value_t const& b) {
+    return std::max(a, b);
+  }
+};
+
+template <typename Tag, typename Augment>
+struct augment_slot {
+  typename Augment::value_t aggregate_{Augment::identity()};
+};
+
+template <typename Tag>
+struct augment_slot<Tag, no_augment> {};
+} // namespace intrusive_map
@@ -0,0 +1,94 @@
+// Обход и поиск в bimap после долгой перетряски и после compact().
+// Использование: bench_compact [пар] [раундов перетряски]
+
+#include "bimap.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+struct compact_policy : intrusive_map::default_policy {
+  static constexpr bool compactable = true;
+};
+using bench_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                          compact_policy>;
+
+template <typename F>
+double seconds(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Время одного обхода каждой стороны и пачки случайных поисков
+void measure(char const* name, bench_bimap const& b,
+             std::vector<int> const& keys) {
+  long long sum = 0;
+  double left = seconds([&] {
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      sum += it.get_value();
+    }
+  });
+  double right = seconds([&] {
+    for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+      sum += it.get_value();
+    }
+  });
+  double find = seconds([&] {
+    for (int key : keys) {
+      sum += b.find_left(key) != b.end_left();
+    }
+  });
+  std::cout << name << ": scan left " << left * 1e3 << " ms, scan right "
+            << right * 1e3 << " ms, " << keys.size() << " finds "
+            << find * 1e3 << " ms (" << sum << ")\n";
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  std::size_t pairs = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::size_t rounds = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+  auto range = static_cast<unsigned>(pairs * 4);
+
+  std::mt19937 e(42);
+  bench_bimap b;
+  // Вершины перемешиваются в куче с посторонними аллокациями, часть
+  // которых потом освобождается, как в долгоживущем процессе
+  std::vector<std::unique_ptr<char[]>> noise;
+  auto churn = [&] {
+    while (b.size() < pairs) {
+      int key = static_cast<int>(e() % range);
+      b.insert(key, key);
+      noise.emplace_back(new char[16 + e() % 64]);
+    }
+    for (std::size_t i = 0; i < noise.size(); i += 2) {
+      noise[i].reset();
+    }
+    for (std::size_t i = 0; i < pairs / 2; i++) {
+      b.erase_left(static_cast<int>(e() % range));
+    }
+  };
+  for (std::size_t r = 0; r < rounds; r++) {
+    churn();
+  }
+  while (b.size() < pairs) {
+    int key = static_cast<int>(e() % range);
+    b.insert(key, key);
+  }
+
+  std::vector<int> keys(pairs);
+  for (int& key : keys) {
+    key = static_cast<int>(e() % range);
+  }
+  std::cout << b.size() << " pairs after " << rounds << " churn rounds\n";
+  measure("scattered", b, keys);
+  std::cout << "compact: " << seconds([&] { b.compact(); }) * 1e3 << " ms\n";
+  measure("compact by left", b, keys);
+  b.compact<intrusive_map::right_tag>();
+  measure("compact by right", b, keys);
+}
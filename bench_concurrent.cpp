@@ -0,0 +1,85 @@
+// Сравнение concurrent_bimap с bimap под одним мьютексом на смешанной
+// нагрузке insert / erase_left / find_left из нескольких потоков.
+// Использование: bench_concurrent [потоков] [операций на поток]
+
+#include "concurrent_bimap.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+struct mutex_bimap {
+  bool insert(int left, int right) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return b_.insert(left, right) != b_.end_left();
+  }
+  bool erase_left(int left) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return b_.erase_left(left);
+  }
+  bool find_left(int left) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return b_.find_left(left) != b_.end_left();
+  }
+
+  std::mutex mutex_;
+  bimap<int, int> b_;
+};
+
+template <typename Map>
+double run(Map& map, std::size_t threads, std::size_t ops) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (std::size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&map, t, ops] {
+      std::mt19937 e(static_cast<unsigned>(t));
+      for (std::size_t i = 0; i < ops; i++) {
+        int key = static_cast<int>(e() % 100000);
+        switch (e() % 4) {
+        case 0:
+        case 1:
+          map.insert(key, key);
+          break;
+        case 2:
+          map.erase_left(key);
+          break;
+        default:
+          map.find_left(key);
+          break;
+        }
+      }
+    });
+  }
+  for (std::thread& w : workers) {
+    w.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return static_cast<double>(threads * ops) / elapsed.count();
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  std::size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                 : std::thread::hardware_concurrency();
+  std::size_t ops = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+  if (threads == 0) {
+    threads = 1;
+  }
+
+  mutex_bimap locked;
+  concurrent_bimap<int, int> combined;
+  double locked_rate = run(locked, threads, ops);
+  double combined_rate = run(combined, threads, ops);
+
+  std::cout << threads << " threads, " << ops << " ops per thread\n";
+  std::cout << "mutex bimap:      " << locked_rate << " ops/s\n";
+  std::cout << "concurrent_bimap: " << combined_rate << " ops/s, "
+            << static_cast<double>(combined.combined()) /
+                   static_cast<double>(combined.batches())
+            << " ops per batch\n";
+}
@@ -1,26 +1,121 @@
 #pragma once
 
 #include "bimap_node.h"
+#include "bimap_policy.h"
+#include "changeset.h"
+#include "fingerprint.h"
+#include "frozen_bimap.h"
 #include "intusive_map.h"
+#include "journal.h"
+#include "lookup_cache.h"
+#include "node_pool.h"
+#include "reclaimer.h"
+#include <algorithm>
 #include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace intrusive_map {
+// Тег конструктора от последовательности пар, отсортированной по left
+// без повторов left
+struct sorted_unique_t {
+  explicit sorted_unique_t() = default;
+};
+inline constexpr sorted_unique_t sorted_unique{};
+} // namespace intrusive_map
 
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>,
+          typename Policy = intrusive_map::default_policy>
 struct bimap {
 private:
   using left_t = Left;
   using right_t = Right;
 
-  using node_t = intrusive_map::bimap_node<Left, Right>;
+  using node_t = intrusive_map::policy_bimap_node<Left, Right, Policy>;
+  using stats_t = typename Policy::stats;
 
   intrusive_map::empty_bimap_node root_{};
   intrusive_map::intrusive_map<Left, Right, intrusive_map::left_tag,
-                               CompareLeft>
+                               CompareLeft, stats_t, node_t>
       left_map_;
   intrusive_map::intrusive_map<Left, Right, intrusive_map::right_tag,
-                               CompareRight>
+                               CompareRight, stats_t, node_t>
       right_map_;
   size_t size_{0};
+  [[no_unique_address]] stats_t stats_;
+  [[no_unique_address]] intrusive_map::inline_node_pool<
+      node_t, Policy::inline_capacity> pool_;
+  using arena_t = std::conditional_t<Policy::compactable,
+                                     intrusive_map::node_arena<node_t>,
+                                     intrusive_map::no_arena>;
+  [[no_unique_address]] arena_t arena_;
+
+  struct no_fingers {
+    void forget(intrusive_map::empty_bimap_node const*) {}
+    void reset() {}
+  };
+  struct last_found {
+    intrusive_map::base_node const* left{nullptr};
+    intrusive_map::base_node const* right{nullptr};
+    void forget(intrusive_map::empty_bimap_node const* node) {
+      if (left == intrusive_map::downcast<intrusive_map::left_tag>(node) ||
+          right == intrusive_map::downcast<intrusive_map::right_tag>(node)) {
+        reset();
+      }
+    }
+    void reset() {
+      left = nullptr;
+      right = nullptr;
+    }
+  };
+  // Последние найденные элементы для Policy::remember_finger,
+  // nullptr — искать от корня
+  [[no_unique_address]] mutable std::conditional_t<Policy::remember_finger,
+                                                   last_found, no_fingers>
+      fingers_;
+
+  // erase_if и apply пересобирают деревья, если затрагивают хотя бы 1/8
+  // пар, иначе меняют их поштучно
+  static constexpr std::size_t bulk_ratio = 8;
+
+  static constexpr std::size_t cache_size = Policy::lookup_cache_size;
+  [[no_unique_address]] mutable intrusive_map::lookup_cache<
+      intrusive_map::left_tag, Left, cache_size>
+      left_cache_;
+  [[no_unique_address]] mutable intrusive_map::lookup_cache<
+      intrusive_map::right_tag, Right, cache_size>
+      right_cache_;
+
+  using left_index_t =
+      intrusive_map::side_index<intrusive_map::left_tag, Left, CompareLeft,
+                                typename Policy::left_index>;
+  using right_index_t =
+      intrusive_map::side_index<intrusive_map::right_tag, Right, CompareRight,
+                                typename Policy::right_index>;
+  [[no_unique_address]] left_index_t left_index_;
+  [[no_unique_address]] right_index_t right_index_;
+
+  static constexpr std::size_t lru_capacity = Policy::lru_capacity;
+  [[no_unique_address]] mutable std::conditional_t<
+      (lru_capacity > 0), intrusive_map::recency_list<Left, Right>,
+      intrusive_map::no_recency>
+      lru_;
+
+  [[no_unique_address]] std::conditional_t<
+      Policy::journal, intrusive_map::journal_sink, intrusive_map::no_journal>
+      journal_;
+
+  [[no_unique_address]] std::conditional_t<
+      Policy::track_fingerprint,
+      intrusive_map::fingerprint_tracker<Left, Right>,
+      intrusive_map::no_fingerprint>
+      fingerprint_;
 
 public:
   using right_iterator =
@@ -34,22 +129,90 @@ public:
       : root_(), left_map_(root_, std::move(compare_left)),
         right_map_(root_, std::move(compare_right)) {}
 
+  // Строит bimap из пар [first, last), отсортированных по left без повторов
+  // left. Левое дерево связывается сразу сбалансированным за O(n), правое —
+  // после сортировки по right за O(n log n). Пара, чей right уже встречался
+  // раньше в последовательности, пропускается, как при insert
+  template <typename It>
+  bimap(intrusive_map::sorted_unique_t, It first, It last,
+        CompareLeft compare_left = CompareLeft(),
+        CompareRight compare_right = CompareRight())
+      : bimap(std::move(compare_left), std::move(compare_right)) {
+    std::vector<node_t*> nodes;
+    try {
+      for (; first != last; ++first) {
+        auto&& [left, right] = *first;
+        nodes.push_back(create_node(left, right));
+      }
+    } catch (...) {
+      for (node_t* node : nodes) {
+        destroy_node(node);
+      }
+      throw;
+    }
+    link_sorted(nodes);
+  }
+
   // Конструкторы от других и присваивания
+  // С Policy::lru_capacity копия сохраняет порядок давности и on_evict
   bimap(bimap const& other) : bimap() {
-    for (left_iterator it = other.begin_left(); it != other.end_left(); ++it) {
-      insert(*it, it.get_value());
+    if constexpr (lru_capacity > 0) {
+      lru_.on_evict_ = other.lru_.on_evict_;
+      for (auto const* link = other.lru_.oldest(); link != other.lru_.end();
+           link = link->next_) {
+        node_t const* node = from_link(link);
+        insert(node->left_value_, node->right_value_);
+      }
+    } else {
+      for (left_iterator it = other.begin_left(); it != other.end_left();
+           ++it) {
+        insert(*it, it.get_value());
+      }
     }
   }
+  // Вершины из кучи переезжают вместе с деревьями, а вершины, лежащие во
+  // встроенном буфере other, переносятся в буфер этой bimap,
+  // поэтому итераторы на них инвалидируются (как у small_vector)
   bimap(bimap&& other) noexcept
       : root_(std::move(other.root_)), size_(other.size_), left_map_(root_),
-        right_map_(root_) {}
+        right_map_(root_), arena_(std::move(other.arena_)),
+        left_index_(std::move(other.left_index_)),
+        right_index_(std::move(other.right_index_)),
+        lru_(std::move(other.lru_)), fingerprint_(other.fingerprint_) {
+    other.journal_.record(intrusive_map::journal_op::clear);
+    other.size_ = 0;
+    other.fingerprint_.reset();
+    other.fingers_.reset();
+    other.left_cache_.clear();
+    other.right_cache_.clear();
+    adopt_inline_nodes(other);
+  }
 
   // root_ не надо свапать, так как left_map_.swap свапает его часть с left_tag
   // а righ_map_ его часть с right_tag
   void swap(bimap& rhs) {
-    left_map_.swap(rhs.left_map_);
-    right_map_.swap(rhs.right_map_);
-    std::swap(size_, rhs.size_);
+    fingers_.reset();
+    rhs.fingers_.reset();
+    left_cache_.clear();
+    right_cache_.clear();
+    rhs.left_cache_.clear();
+    rhs.right_cache_.clear();
+    if (pool_.empty() && rhs.pool_.empty()) {
+      left_map_.swap(rhs.left_map_);
+      right_map_.swap(rhs.right_map_);
+      arena_.swap(rhs.arena_);
+      left_index_.swap(rhs.left_index_);
+      right_index_.swap(rhs.right_index_);
+      lru_.swap(rhs.lru_);
+      fingerprint_.swap(rhs.fingerprint_);
+      std::swap(size_, rhs.size_);
+    } else {
+      bimap tmp(std::move(rhs));
+      rhs.take(*this);
+      take(tmp);
+    }
+    journal_contents();
+    rhs.journal_contents();
   }
 
   bimap& operator=(bimap const& other) {
@@ -70,11 +233,25 @@ public:
   // Деструктор. Вызывается при удалении объектов bimap.
   // Инвалидирует все итераторы ссылающиеся на элементы этого bimap
   // (включая итераторы ссылающиеся на элементы следующие за последними).
+  // С Policy::background_reclaim_threshold большая bimap отдает вершины
+  // фоновому потоку и не ждет их освобождения
   ~bimap() {
-    if (left_map_.root_.left_) {
-      recursive_delete(left_map_.root_.left_);
-    }
+    release_nodes();
   }
+
+  // Удаляет все пары, как деструктор
+  void clear() {
+    journal_.record(intrusive_map::journal_op::clear);
+    release_nodes();
+    left_index_t().swap(left_index_);
+    right_index_t().swap(right_index_);
+    fingers_.reset();
+    left_cache_.clear();
+    right_cache_.clear();
+    fingerprint_.reset();
+    size_ = 0;
+  }
+
   // Вставка пары (left, right), возвращает итератор на left.
   // Если такой left или такой right уже присутствуют в bimap, вставка не
   // производится и возвращается end_left().
@@ -97,9 +274,18 @@ public:
   // Пусть it ссылается на некоторый элемент e.
   // erase инвалидирует все итераторы ссылающиеся на e и на элемент парный к e.
   left_iterator erase_left(left_iterator it) {
+    journal_.record(intrusive_map::journal_op::erase, *it);
+    fingerprint_.remove(*it, *it.flip());
+    fingers_.forget(
+        intrusive_map::upcast_to_empty_bimap_node<intrusive_map::left_tag>(
+            it.ptr_));
+    left_cache_.forget(*it, it.ptr_);
+    right_cache_.forget(*it.flip(), it.flip().ptr_);
+    left_index_.erase(*it);
+    right_index_.erase(*it.flip());
     left_iterator ret = left_map_.erase(it);
     right_map_.erase(it.flip());
-    delete (upcast_left(it.ptr_));
+    destroy_node(upcast_left(it.ptr_));
     size_--;
     return ret;
   }
@@ -141,12 +327,166 @@ public:
     return first;
   }
 
+  // Удаляет пары, для которых pred(left, right) == true, за один обход и
+  // возвращает их число. Если удаляется заметная доля пар, оба дерева
+  // пересобираются сбалансированными из выживших вершин за O(n) вместо
+  // поштучного erase. Инвалидирует только итераторы на удаленные пары
+  template <typename Pred>
+  std::size_t erase_if(Pred pred) {
+    std::vector<node_t*> order;
+    std::vector<node_t*> victims;
+    order.reserve(size_);
+    for (left_iterator it = begin_left(); it != end_left(); ++it) {
+      node_t* node = const_cast<node_t*>(upcast_left(it.ptr_));
+      if (pred(node->left_value_, node->right_value_)) {
+        victims.push_back(node);
+      } else {
+        order.push_back(node);
+      }
+    }
+    if (victims.size() * bulk_ratio < size_) {
+      for (node_t* node : victims) {
+        erase_left(left_iterator(
+            intrusive_map::downcast<Left, Right, intrusive_map::left_tag>(
+                node)));
+      }
+      return victims.size();
+    }
+
+    std::vector<node_t*> right_order;
+    right_order.reserve(order.size());
+    std::sort(victims.begin(), victims.end(), std::less<>());
+    for (right_iterator it = begin_right(); it != end_right(); ++it) {
+      node_t* node = const_cast<node_t*>(upcast_right(it.ptr_));
+      if (!std::binary_search(victims.begin(), victims.end(), node,
+                              std::less<>())) {
+        right_order.push_back(node);
+      }
+    }
+    fingers_.reset();
+    left_cache_.clear();
+    right_cache_.clear();
+    left_map_.root_.left_ = nullptr;
+    right_map_.root_.left_ = nullptr;
+    for (node_t* node : victims) {
+      journal_.record(intrusive_map::journal_op::erase, node->left_value_);
+      fingerprint_.remove(node->left_value_, node->right_value_);
+      left_index_.erase(node->left_value_);
+      right_index_.erase(node->right_value_);
+      destroy_node(node);
+    }
+    left_map_.link_sorted(order.data(), order.size());
+    right_map_.link_sorted(right_order.data(), right_order.size());
+    size_ = order.size();
+    left_map_.stats_.on_restructure();
+    right_map_.stats_.on_restructure();
+    return victims.size();
+  }
+
+  using changeset_t = intrusive_map::changeset<Left, Right>;
+
+  // Применяет пачку изменений, см. intrusive_map::changeset. Пачка
+  // сортируется по left и сливается с левым деревом за один проход, а
+  // правый порядок собирается слиянием правого дерева с новыми парами,
+  // отсортированными по right; оба дерева затем связываются
+  // сбалансированными. Маленькая пачка применяется поштучно.
+  // Если два upsert пачки дают разным left один right, бросает
+  // std::invalid_argument и bimap не меняется. Пары, которые пачка
+  // удаляет или меняет, и пары, у которых upsert забрал right,
+  // инвалидируются; пара, совпадающая с upsert, остается на месте
+  void apply(changeset_t changes) {
+    using entry = typename changeset_t::entry;
+    auto& entries = changes.entries();
+    std::vector<entry*> ops;
+    ops.reserve(entries.size());
+    for (entry& e : entries) {
+      ops.push_back(&e);
+    }
+    std::stable_sort(ops.begin(), ops.end(), [this](entry* a, entry* b) {
+      return left_map_.cmp(a->left, b->left) < 0;
+    });
+    // По каждому left остается последняя операция
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < ops.size(); i++) {
+      if (i + 1 == ops.size() ||
+          left_map_.cmp(ops[i]->left, ops[i + 1]->left) != 0) {
+        ops[n++] = ops[i];
+      }
+    }
+    ops.resize(n);
+    check_upsert_rights(ops);
+
+    // С Policy::lru_capacity новые пары проходят через вытеснение в insert
+    if (lru_capacity > 0 || ops.size() * bulk_ratio < size_) {
+      apply_one_by_one(ops);
+    } else {
+      apply_merged(ops);
+    }
+  }
+
   // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  // С Policy::lru_capacity найденная пара становится самой свежей: const
+  // find_* / at_* меняют список давности, и одновременные чтения из разных
+  // потоков — гонка
   left_iterator find_left(left_t const& left) const {
-    return left_map_.find(left);
+    left_iterator it = lookup_left(left);
+    if (it != end_left()) {
+      touch(upcast_left(it.ptr_));
+    }
+    return it;
   }
   right_iterator find_right(right_t const& right) const {
-    return right_map_.find(right);
+    right_iterator it = lookup_right(right);
+    if (it != end_right()) {
+      touch(upcast_right(it.ptr_));
+    }
+    return it;
+  }
+
+  // Попадания и промахи кэша поиска каждой стороны
+  intrusive_map::cache_counters cache_counters_left() const
+    requires(cache_size > 0)
+  {
+    return left_cache_.counters();
+  }
+  intrusive_map::cache_counters cache_counters_right() const
+    requires(cache_size > 0)
+  {
+    return right_cache_.counters();
+  }
+
+  // Policy::journal: sink получает по одной записи на каждую успешную
+  // мутацию (и не должен бросать исключений), intrusive_map::replay
+  // применяет их к другой bimap. sink остается у этого объекта при swap и
+  // присваиваниях, см. journal.h
+  void journal_to(intrusive_map::journal_sink::sink_t sink)
+    requires(Policy::journal)
+  {
+    journal_.set(std::move(sink));
+  }
+
+  // Policy::lru_capacity: f вызывается с ключами вытесняемой пары перед ее
+  // удалением и не должен бросать исключений
+  void on_evict(std::function<void(Left const&, Right const&)> f)
+    requires(lru_capacity > 0)
+  {
+    lru_.on_evict_ = std::move(f);
+  }
+  static constexpr std::size_t capacity()
+    requires(lru_capacity > 0)
+  {
+    return lru_capacity;
+  }
+
+  // Поиск от итератора finger (в том числе end), быстрее find_left, если
+  // искомый ключ близок к finger
+  left_iterator find_left_from(left_iterator finger,
+                               left_t const& left) const {
+    return left_map_.find_from(finger, left);
+  }
+  right_iterator find_right_from(right_iterator finger,
+                                 right_t const& right) const {
+    return right_map_.find_from(finger, right);
   }
 
   // Возвращает противоположный элемент по элементу
@@ -181,12 +521,10 @@ public:
       return upcast_left(left_it)->right_value_;
     } else {
       right_t def = right_t();
-      intrusive_map::base_node* right_it = right_map_.find_impl(def);
-      if (right_map_.cmp(right_it, def) == 0) {
-        upcast_right(right_it)->left_value_ = key;
-        left_map_.erase_impl(left_it);
-        left_map_.insert(*upcast_left(left_it));
-        return upcast_right(right_it)->right_value_;
+      right_iterator it = find_right(def);
+      if (it != end_right()) {
+        replace_left(it, key);
+        return *it;
       } else {
         return insert(key, std::move(def)).get_value();
       }
@@ -198,36 +536,118 @@ public:
   left_t const& at_right_or_default(right_t const& key) {
     intrusive_map::base_node* right_it = right_map_.find_impl(key);
     if (right_map_.cmp(right_it, key) == 0) {
-      return upcast_left(right_it)->left_value_;
+      return upcast_right(right_it)->left_value_;
     } else {
       left_t def = left_t();
-      intrusive_map::base_node* left_it = left_map_.find_impl(def);
-      if (left_map_.cmp(left_it, def) == 0) {
-        upcast_left(left_it)->right_value_ = key;
-        left_map_.erase_impl(right_it);
-        right_map_.insert(*upcast_right(right_it));
-        return upcast_left(left_it)->left_value_;
+      left_iterator it = find_left(def);
+      if (it != end_left()) {
+        replace_right(it, key);
+        return *it;
       } else {
         return *insert(std::move(def), key);
       }
     }
   }
 
+  // Заменяет left у пары, на которую указывает it, без переаллокации вершины:
+  // перевешивается только вершина в левом дереве, правое дерево и все
+  // итераторы на пару остаются валидными.
+  // Если такой left уже есть у другой пары, ничего не делает и возвращает
+  // end_left(), иначе возвращает итератор на новый left
+  left_iterator replace_left(right_iterator it, left_t left) {
+    node_t* node = const_cast<node_t*>(upcast_right(it.ptr_));
+    left_cache_.forget(node->left_value_, it.flip().ptr_);
+    fingerprint_.remove(node->left_value_, node->right_value_);
+    bool replaced = false;
+    try {
+      replaced = replace_key<intrusive_map::left_tag>(
+          left_map_, left_index_, node, node->left_value_,
+          std::move(left));
+    } catch (...) {
+      fingerprint_.add(node->left_value_, node->right_value_);
+      throw;
+    }
+    fingerprint_.add(node->left_value_, node->right_value_);
+    if (!replaced) {
+      return end_left();
+    }
+    journal_.record(intrusive_map::journal_op::replace_left,
+                    node->right_value_, node->left_value_);
+    right_map_.refresh_up(
+        intrusive_map::downcast<Left, Right, intrusive_map::right_tag>(node));
+    return it.flip();
+  }
+  // Аналогично replace_left, но меняет right у пары по итератору на left
+  right_iterator replace_right(left_iterator it, right_t right) {
+    node_t* node = const_cast<node_t*>(upcast_left(it.ptr_));
+    right_cache_.forget(node->right_value_, it.flip().ptr_);
+    fingerprint_.remove(node->left_value_, node->right_value_);
+    bool replaced = false;
+    try {
+      replaced = replace_key<intrusive_map::right_tag>(
+          right_map_, right_index_, node, node->right_value_,
+          std::move(right));
+    } catch (...) {
+      fingerprint_.add(node->left_value_, node->right_value_);
+      throw;
+    }
+    fingerprint_.add(node->left_value_, node->right_value_);
+    if (!replaced) {
+      return end_right();
+    }
+    journal_.record(intrusive_map::journal_op::replace_right,
+                    node->left_value_, node->right_value_);
+    left_map_.refresh_up(
+        intrusive_map::downcast<Left, Right, intrusive_map::left_tag>(node));
+    return it.flip();
+  }
+
   // lower и upper bound'ы по каждой стороне
   // Возвращают итераторы на соответствующие элементы
   // Смотри std::lower_bound, std::upper_bound.
+  // С упорядоченным индексом стороны (Policy::left_index / right_index)
+  // поиск идет по нему
   left_iterator lower_bound_left(const left_t& left) const {
-    return left_map_.lower_bound(left);
+    if constexpr (left_index_t::ordered) {
+      return from_index(left_index_.lower_bound(left), end_left());
+    } else {
+      return left_map_.lower_bound(left);
+    }
   }
   left_iterator upper_bound_left(const left_t& left) const {
-    return left_map_.upper_bound(left);
+    if constexpr (left_index_t::ordered) {
+      return from_index(left_index_.upper_bound(left), end_left());
+    } else {
+      return left_map_.upper_bound(left);
+    }
   }
 
   right_iterator lower_bound_right(const right_t& right) const {
-    return right_map_.lower_bound(right);
+    if constexpr (right_index_t::ordered) {
+      return from_index(right_index_.lower_bound(right), end_right());
+    } else {
+      return right_map_.lower_bound(right);
+    }
   }
   right_iterator upper_bound_right(const right_t& right) const {
-    return right_map_.upper_bound(right);
+    if constexpr (right_index_t::ordered) {
+      return from_index(right_index_.upper_bound(right), end_right());
+    } else {
+      return right_map_.upper_bound(right);
+    }
+  }
+
+  // Агрегат Policy::left_augment по right всех пар с left из [lo, hi) и
+  // наоборот для aggregate_right. Работает за высоту дерева
+  auto aggregate_left(left_t const& lo, left_t const& hi) const
+    requires node_t::template has_augment<intrusive_map::left_tag>
+  {
+    return left_map_.aggregate(lo, hi);
+  }
+  auto aggregate_right(right_t const& lo, right_t const& hi) const
+    requires node_t::template has_augment<intrusive_map::right_tag>
+  {
+    return right_map_.aggregate(lo, hi);
   }
 
   // Возващает итератор на минимальный по порядку left.
@@ -258,11 +678,129 @@ public:
     return size_;
   }
 
+  // Диагностика формы деревьев, каждый вызов — один обход за O(n)
+  intrusive_map::tree_shape shape_left() const {
+    return left_map_.shape();
+  }
+  intrusive_map::tree_shape shape_right() const {
+    return right_map_.shape();
+  }
+  std::size_t height_left() const {
+    return shape_left().height;
+  }
+  std::size_t height_right() const {
+    return shape_right().height;
+  }
+
+  // Компараторы сторон
+  CompareLeft key_comp_left() const {
+    return left_map_.key_comp();
+  }
+  CompareRight key_comp_right() const {
+    return right_map_.key_comp();
+  }
+
+  // Policy::compactable: переносит все вершины в один непрерывный блок в
+  // порядке стороны Tag, так что обход этой стороны и спуски по дереву идут
+  // по памяти почти подряд. Ключи перемещаются, деревья и индексы
+  // перевешиваются на новые адреса; инвалидирует все итераторы. Удаленные
+  // после этого вершины оставляют в блоке дыры, а новые берутся из кучи,
+  // так что после заметной перетряски compact стоит повторить
+  template <typename Tag = intrusive_map::left_tag>
+  void compact()
+    requires(Policy::compactable &&
+             std::is_nothrow_move_constructible_v<Left> &&
+             std::is_nothrow_move_constructible_v<Right>)
+  {
+    if (size_ == 0) {
+      return;
+    }
+    std::vector<node_t*> nodes;
+    nodes.reserve(size_);
+    if constexpr (std::is_same_v<Tag, intrusive_map::left_tag>) {
+      for (left_iterator it = begin_left(); it != end_left(); ++it) {
+        nodes.push_back(const_cast<node_t*>(upcast_left(it.ptr_)));
+      }
+    } else {
+      for (right_iterator it = begin_right(); it != end_right(); ++it) {
+        nodes.push_back(const_cast<node_t*>(upcast_right(it.ptr_)));
+      }
+    }
+    intrusive_map::node_arena<node_t> arena(size_);
+    stats_.on_allocate();
+    fingers_.reset();
+    left_cache_.clear();
+    right_cache_.clear();
+    for (node_t* node : nodes) {
+      relocate_node(node, arena.allocate());
+      destroy_node(node);
+    }
+    arena_ = std::move(arena);
+  }
+
+  // Неизменяемая копия для read-only нагрузки: поиск в frozen_bimap идет по
+  // непрерывному массиву без ветвлений и не зависит от формы деревьев.
+  // Строится за O(n log n)
+  frozen_bimap<Left, Right, CompareLeft, CompareRight> freeze() const {
+    using node_rank = std::pair<intrusive_map::base_node const*, std::size_t>;
+    std::vector<left_t> lefts;
+    std::vector<right_t> rights;
+    std::vector<node_rank> ranks;
+    lefts.reserve(size_);
+    rights.reserve(size_);
+    ranks.reserve(size_);
+    for (right_iterator it = begin_right(); it != end_right(); ++it) {
+      ranks.emplace_back(it.flip().ptr_, rights.size());
+      rights.push_back(*it);
+    }
+    std::sort(ranks.begin(), ranks.end(),
+              [](node_rank const& a, node_rank const& b) {
+                return std::less<>()(a.first, b.first);
+              });
+    std::vector<std::size_t> right_rank;
+    right_rank.reserve(size_);
+    for (left_iterator it = begin_left(); it != end_left(); ++it) {
+      lefts.push_back(*it);
+      right_rank.push_back(
+          std::lower_bound(ranks.begin(), ranks.end(), it.ptr_,
+                           [](node_rank const& a,
+                              intrusive_map::base_node const* p) {
+                             return std::less<>()(a.first, p);
+                           })
+              ->second);
+    }
+    return {lefts, rights, right_rank, key_comp_left(), key_comp_right()};
+  }
+
+  // Снимок счетчиков политики Policy::stats: по каждому дереву и по вершинам.
+  // С no_stats все счетчики пустые
+  intrusive_map::bimap_stats<stats_t> stats() const {
+    return {left_map_.stats_, right_map_.stats_, stats_};
+  }
+  void reset_stats() {
+    left_map_.stats_ = stats_t();
+    right_map_.stats_ = stats_t();
+    stats_ = stats_t();
+  }
+
+  // Policy::track_fingerprint: отпечаток множества пар, равен у равных bimap
+  intrusive_map::content_fingerprint fingerprint() const
+    requires(Policy::track_fingerprint)
+  {
+    return fingerprint_.value();
+  }
+
   // операторы сравнения
+  // С Policy::track_fingerprint неравные отпечатки отсекаются за O(1)
   friend bool operator==(bimap const& a, bimap const& b) {
     if (a.size_ != b.size_) {
       return false;
     }
+    if constexpr (Policy::track_fingerprint) {
+      if (a.fingerprint_.value() != b.fingerprint_.value()) {
+        return false;
+      }
+    }
     left_iterator it1 = a.begin_left();
     left_iterator it2 = b.begin_left();
     for (; it1 != a.end_left() && it2 != b.end_left(); ++it1, ++it2) {
@@ -277,48 +815,744 @@ public:
   }
 
 private:
+  // С Policy::lookup_cache_size > 0 сначала проверяется кэш недавних поисков
+  left_iterator lookup_left(left_t const& left) const {
+    if constexpr (cache_size > 0) {
+      intrusive_map::base_node const*& slot = left_cache_.slot(left);
+      if (slot && left_map_.cmp(slot, left) == 0) {
+        left_cache_.hit();
+        return left_iterator(slot);
+      }
+      left_cache_.miss();
+      left_iterator it = find_left_in_tree(left);
+      if (it != end_left()) {
+        slot = it.ptr_;
+      }
+      return it;
+    } else {
+      return find_left_in_tree(left);
+    }
+  }
+  right_iterator lookup_right(right_t const& right) const {
+    if constexpr (cache_size > 0) {
+      intrusive_map::base_node const*& slot = right_cache_.slot(right);
+      if (slot && right_map_.cmp(slot, right) == 0) {
+        right_cache_.hit();
+        return right_iterator(slot);
+      }
+      right_cache_.miss();
+      right_iterator it = find_right_in_tree(right);
+      if (it != end_right()) {
+        slot = it.ptr_;
+      }
+      return it;
+    } else {
+      return find_right_in_tree(right);
+    }
+  }
+
+  // С Policy::left_index / right_index поиск идет по индексу (по дереву —
+  // для ключей, которых индекс не покрывает), иначе с
+  // Policy::remember_finger — от последнего найденного элемента
+  left_iterator find_left_in_tree(left_t const& left) const {
+    if constexpr (left_index_t::enabled) {
+      if (left_index_.covers(left)) {
+        return from_index(left_index_.find(left), end_left());
+      }
+      return left_map_.find(left);
+    } else if constexpr (Policy::remember_finger) {
+      left_iterator it = left_map_.find_from(
+          fingers_.left ? left_iterator(fingers_.left) : end_left(), left);
+      if (it != end_left()) {
+        fingers_.left = it.ptr_;
+      }
+      return it;
+    } else {
+      return left_map_.find(left);
+    }
+  }
+  right_iterator find_right_in_tree(right_t const& right) const {
+    if constexpr (right_index_t::enabled) {
+      if (right_index_.covers(right)) {
+        return from_index(right_index_.find(right), end_right());
+      }
+      return right_map_.find(right);
+    } else if constexpr (Policy::remember_finger) {
+      right_iterator it = right_map_.find_from(
+          fingers_.right ? right_iterator(fingers_.right) : end_right(),
+          right);
+      if (it != end_right()) {
+        fingers_.right = it.ptr_;
+      }
+      return it;
+    } else {
+      return right_map_.find(right);
+    }
+  }
+
+  // nullptr из индекса — end
+  template <typename Iterator>
+  static Iterator from_index(intrusive_map::base_node const* node,
+                             Iterator end) {
+    return node ? Iterator(node) : end;
+  }
+
+  // Вершина и записи индексов создаются до того, как вершина попадет в
+  // деревья, а с Policy::lru_capacity — и до вытеснения: если создание
+  // пары бросает, bimap не меняется и on_evict не вызывается
   template <typename L, typename R>
-  left_iterator insert_impl(L&& left, R&& right) noexcept {
-    left_iterator it = end_left();
-    auto* left_ptr = left_map_.find_impl(left);
-    auto* right_ptr = right_map_.find_impl(right);
-    if (left_map_.cmp(left_ptr, left) != 0 &&
-        right_map_.cmp(right_ptr, right) != 0) {
-      auto* node = new intrusive_map::bimap_node<Left, Right>(
-          std::forward<L>(left), std::forward<R>(right));
-      it = left_iterator(left_map_.insert_impl(left_ptr, *node));
-      right_map_.insert_impl(right_ptr, *node);
-      size_++;
+  left_iterator insert_impl(L&& left, R&& right) {
+    auto* left_ptr = probe(left_map_, left_index_, left);
+    auto* right_ptr = probe(right_map_, right_index_, right);
+    if (left_ptr == nullptr || right_ptr == nullptr) {
+      return end_left();
+    }
+    node_t* node = create_node(std::forward<L>(left), std::forward<R>(right));
+    try {
+      index_node(node);
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+    if constexpr (lru_capacity > 0) {
+      if (size_ == lru_capacity) {
+        try {
+          evict();
+        } catch (...) {
+          unindex_node(node);
+          destroy_node(node);
+          throw;
+        }
+        // Стороне с упорядоченным индексом место и так дает link
+        if constexpr (!left_index_t::ordered) {
+          left_ptr = left_map_.find_impl(node->left_value_);
+        }
+        if constexpr (!right_index_t::ordered) {
+          right_ptr = right_map_.find_impl(node->right_value_);
+        }
+      }
+    }
+    left_iterator it(
+        link(left_map_, left_index_, left_ptr, *node, node->left_value_));
+    link(right_map_, right_index_, right_ptr, *node, node->right_value_);
+    if constexpr (lru_capacity > 0) {
+      lru_.push(*node);
     }
+    size_++;
+    journal_.record(intrusive_map::journal_op::insert, node->left_value_,
+                    node->right_value_);
     return it;
   }
 
-  void recursive_delete(intrusive_map::base_node* ptr) {
-    if (ptr == nullptr) {
+  // Место для key на стороне map или nullptr, если ключ уже есть. Сторона с
+  // упорядоченным индексом обходится без спуска со сравнениями: дубликат
+  // ищется в индексе, а место — при связывании, см. link
+  template <typename Map, typename Index, typename Key>
+  static intrusive_map::base_node* probe(Map const& map, Index const& index,
+                                         Key const& key) {
+    if constexpr (Index::ordered) {
+      return index.find(key) ? nullptr : &map.root_;
+    } else {
+      intrusive_map::base_node* pos = map.find_impl(key);
+      return map.cmp(pos, key) != 0 ? pos : nullptr;
+    }
+  }
+
+  // Подвешивает node на сторону map в место pos от probe. Индекс к этому
+  // моменту уже содержит key, поэтому следующий элемент — его upper_bound
+  template <typename Map, typename Index, typename Key>
+  static intrusive_map::base_node* link(Map& map, Index const& index,
+                                        intrusive_map::base_node* pos,
+                                        node_t& node, Key const& key) {
+    if constexpr (Index::ordered) {
+      auto const* next = index.upper_bound(key);
+      return map.insert_before(
+          next ? const_cast<intrusive_map::base_node*>(next) : pos, node);
+    } else {
+      return map.insert_impl(pos, node);
+    }
+  }
+
+  // Связывает в пустой bimap вершины, отсортированные по left без повторов
+  // left. Вершины с повторяющимся right (кроме первой) удаляются. Вершины
+  // попадают в индексы до того, как их свяжут в деревья; если сравнение
+  // или индекс бросают, все вершины удаляются, а bimap остается пустой
+  void link_sorted(std::vector<node_t*>& nodes) {
+    std::vector<node_t*> right_order;
+    std::vector<node_t*> dropped;
+    std::size_t indexed = 0;
+    try {
+      std::vector<std::size_t> by_right(nodes.size());
+      std::iota(by_right.begin(), by_right.end(), 0);
+      std::stable_sort(by_right.begin(), by_right.end(),
+                       [this, &nodes](std::size_t a, std::size_t b) {
+                         return right_map_.cmp(nodes[a]->right_value_,
+                                               nodes[b]->right_value_) < 0;
+                       });
+      std::vector<bool> alive(nodes.size(), true);
+      right_order.reserve(nodes.size());
+      for (std::size_t i = 0; i < by_right.size(); i++) {
+        node_t* node = nodes[by_right[i]];
+        if (!right_order.empty() &&
+            right_map_.cmp(right_order.back()->right_value_,
+                           node->right_value_) == 0) {
+          alive[by_right[i]] = false;
+        } else {
+          right_order.push_back(node);
+        }
+      }
+      dropped.reserve(nodes.size() - right_order.size());
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < nodes.size(); i++) {
+        if (alive[i]) {
+          nodes[n++] = nodes[i];
+        } else {
+          dropped.push_back(nodes[i]);
+        }
+      }
+      nodes.resize(n);
+      for (; indexed < nodes.size(); indexed++) {
+        index_node(nodes[indexed]);
+      }
+    } catch (...) {
+      for (std::size_t i = 0; i < indexed; i++) {
+        unindex_node(nodes[i]);
+      }
+      for (node_t* node : nodes) {
+        destroy_node(node);
+      }
+      for (node_t* node : dropped) {
+        destroy_node(node);
+      }
+      nodes.clear();
+      throw;
+    }
+    for (node_t* node : dropped) {
+      destroy_node(node);
+    }
+    std::size_t n = nodes.size();
+    left_map_.link_sorted(nodes.data(), nodes.size());
+    right_map_.link_sorted(right_order.data(), right_order.size());
+    size_ = n;
+    if constexpr (lru_capacity > 0) {
+      for (node_t* node : nodes) {
+        lru_.push(*node);
+      }
+      while (size_ > lru_capacity) {
+        evict();
+      }
+    }
+  }
+
+  // Policy::lru_capacity: отмечает пару как самую свежую
+  void touch(node_t const* node) const {
+    if constexpr (lru_capacity > 0) {
+      lru_.touch(*node);
+    }
+  }
+
+  static node_t const* from_link(intrusive_map::recency_link const* link)
+    requires(lru_capacity > 0)
+  {
+    return static_cast<node_t const*>(
+        static_cast<intrusive_map::recency_slot<true> const*>(link));
+  }
+
+  // Удаляет самую давнюю пару, предварительно передав ее в on_evict
+  void evict()
+    requires(lru_capacity > 0)
+  {
+    node_t const* node = from_link(lru_.oldest());
+    if (lru_.on_evict_) {
+      lru_.on_evict_(node->left_value_, node->right_value_);
+    }
+    erase_left(left_iterator(
+        static_cast<intrusive_map::map_node<intrusive_map::left_tag> const*>(
+            node)));
+  }
+
+  template <typename Entry>
+  void check_upsert_rights(std::vector<Entry*> const& ops) const {
+    std::vector<Right const*> rights;
+    for (Entry* op : ops) {
+      if (op->right) {
+        rights.push_back(&*op->right);
+      }
+    }
+    std::sort(rights.begin(), rights.end(),
+              [this](Right const* a, Right const* b) {
+                return right_map_.cmp(*a, *b) < 0;
+              });
+    for (std::size_t i = 1; i < rights.size(); i++) {
+      if (right_map_.cmp(*rights[i - 1], *rights[i]) == 0) {
+        throw std::invalid_argument("changeset maps two lefts to one right");
+      }
+    }
+  }
+
+  // Сначала удаляются все затронутые пары, потом вставляются новые, так
+  // что обмен right между парами не упирается в занятый right
+  template <typename Entry>
+  void apply_one_by_one(std::vector<Entry*>& ops) {
+    for (Entry* op : ops) {
+      left_iterator it = find_left(op->left);
+      if (it == end_left()) {
+        continue;
+      }
+      if (op->right && right_map_.cmp(it.get_value(), *op->right) == 0) {
+        op->right.reset(); // пара уже есть
+        continue;
+      }
+      erase_left(it);
+    }
+    for (Entry* op : ops) {
+      if (op->right) {
+        erase_right(*op->right);
+        insert(std::move(op->left), std::move(*op->right));
+      }
+    }
+  }
+
+  // Новые вершины создаются до того, как деревья начнут меняться, поэтому
+  // исключение из конструктора ключей оставляет bimap нетронутой
+  template <typename Entry>
+  void apply_merged(std::vector<Entry*>& ops) {
+    std::vector<node_t*> order;
+    std::vector<node_t*> right_order;
+    std::vector<node_t*> victims;
+    std::vector<node_t*> fresh;
+    // Для каждой новой вершины, уже попавшей в индекс стороны, — прежний
+    // владелец ее ключа или nullptr, если запись была добавлена
+    std::vector<node_t*> left_prev;
+    std::vector<node_t*> right_prev;
+    try {
+      order.reserve(size_ + ops.size());
+      victims.reserve(ops.size());
+      fresh.reserve(ops.size());
+      // Слияние левого дерева с пачкой: новый порядок по left
+      left_iterator it = begin_left();
+      std::size_t i = 0;
+      while (it != end_left() || i < ops.size()) {
+        node_t* node = it != end_left()
+                           ? const_cast<node_t*>(upcast_left(it.ptr_))
+                           : nullptr;
+        int c = -1;
+        if (node == nullptr) {
+          c = 1;
+        } else if (i < ops.size()) {
+          c = left_map_.cmp(node->left_value_, ops[i]->left);
+        }
+        if (c < 0) {
+          order.push_back(node);
+          ++it;
+          continue;
+        }
+        Entry* op = ops[i++];
+        if (c == 0) {
+          ++it;
+          if (op->right &&
+              right_map_.cmp(node->right_value_, *op->right) == 0) {
+            order.push_back(node);
+            continue;
+          }
+          victims.push_back(node);
+        }
+        if (op->right) {
+          fresh.push_back(
+              create_node(std::move(op->left), std::move(*op->right)));
+          order.push_back(fresh.back());
+        }
+      }
+
+      // Слияние правого дерева с новыми вершинами: старая пара, чей right
+      // забрал upsert, вытесняется
+      std::sort(victims.begin(), victims.end(), std::less<>());
+      std::vector<node_t*> by_right(fresh);
+      std::sort(by_right.begin(), by_right.end(),
+                [this](node_t const* a, node_t const* b) {
+                  return right_map_.cmp(a->right_value_, b->right_value_) < 0;
+                });
+      std::vector<node_t*> displaced;
+      right_order.reserve(order.size());
+      auto next = by_right.begin();
+      for (right_iterator r = begin_right(); r != end_right(); ++r) {
+        node_t* node = const_cast<node_t*>(upcast_right(r.ptr_));
+        while (next != by_right.end() &&
+               right_map_.cmp((*next)->right_value_, node->right_value_) < 0) {
+          right_order.push_back(*next++);
+        }
+        if (std::binary_search(victims.begin(), victims.end(), node,
+                               std::less<>())) {
+          continue;
+        }
+        if (next != by_right.end() &&
+            right_map_.cmp((*next)->right_value_, node->right_value_) == 0) {
+          displaced.push_back(node);
+          continue;
+        }
+        right_order.push_back(node);
+      }
+      right_order.insert(right_order.end(), next, by_right.end());
+      if (!displaced.empty()) {
+        std::sort(displaced.begin(), displaced.end(), std::less<>());
+        std::erase_if(order, [&displaced](node_t* node) {
+          return std::binary_search(displaced.begin(), displaced.end(), node,
+                                    std::less<>());
+        });
+        victims.insert(victims.end(), displaced.begin(), displaced.end());
+      }
+
+      // Индексы обновляются до перестройки деревьев: ключ, который сейчас
+      // у вытесняемой пары, переназначается новой вершине без выделения
+      // памяти, остальные ключи добавляются
+      left_prev.reserve(fresh.size());
+      right_prev.reserve(fresh.size());
+      for (node_t* node : fresh) {
+        left_prev.push_back(index_fresh<intrusive_map::left_tag>(
+            left_map_, left_index_, node, node->left_value_));
+        right_prev.push_back(index_fresh<intrusive_map::right_tag>(
+            right_map_, right_index_, node, node->right_value_));
+      }
+    } catch (...) {
+      for (std::size_t i = 0; i < left_prev.size(); i++) {
+        unindex_fresh<intrusive_map::left_tag>(left_index_, left_prev[i],
+                                               fresh[i]->left_value_);
+      }
+      for (std::size_t i = 0; i < right_prev.size(); i++) {
+        unindex_fresh<intrusive_map::right_tag>(right_index_, right_prev[i],
+                                                fresh[i]->right_value_);
+      }
+      for (node_t* node : fresh) {
+        destroy_node(node);
+      }
+      throw;
+    }
+
+    fingers_.reset();
+    left_cache_.clear();
+    right_cache_.clear();
+    left_map_.root_.left_ = nullptr;
+    right_map_.root_.left_ = nullptr;
+    // Дальше ничего не бросает. Записи ключей, перешедших к новым вершинам,
+    // у вытесняемых пар уже переназначены
+    std::erase(left_prev, nullptr);
+    std::erase(right_prev, nullptr);
+    std::sort(left_prev.begin(), left_prev.end(), std::less<>());
+    std::sort(right_prev.begin(), right_prev.end(), std::less<>());
+    for (node_t* node : victims) {
+      journal_.record(intrusive_map::journal_op::erase, node->left_value_);
+      fingerprint_.remove(node->left_value_, node->right_value_);
+      if (!std::binary_search(left_prev.begin(), left_prev.end(), node,
+                              std::less<>())) {
+        left_index_.erase(node->left_value_);
+      }
+      if (!std::binary_search(right_prev.begin(), right_prev.end(), node,
+                              std::less<>())) {
+        right_index_.erase(node->right_value_);
+      }
+      destroy_node(node);
+    }
+    left_map_.link_sorted(order.data(), order.size());
+    right_map_.link_sorted(right_order.data(), right_order.size());
+    for (node_t* node : fresh) {
+      fingerprint_.add(node->left_value_, node->right_value_);
+      journal_.record(intrusive_map::journal_op::insert, node->left_value_,
+                      node->right_value_);
+    }
+    size_ = order.size();
+    left_map_.stats_.on_restructure();
+    right_map_.stats_.on_restructure();
+  }
+
+  // Запись индекса стороны Tag для новой вершины node, пока деревья еще
+  // старые. Возвращает прежнего владельца key: его запись переназначается,
+  // иначе (nullptr) запись добавляется
+  template <typename Tag, typename Map, typename Index, typename Key>
+  static node_t* index_fresh(Map const& map, Index& index, node_t* node,
+                             Key const& key) {
+    intrusive_map::base_node* pos = map.find_impl(key);
+    intrusive_map::base_node* self =
+        intrusive_map::downcast<Left, Right, Tag>(node);
+    if (map.cmp(pos, key) == 0) {
+      index.assign(key, self);
+      return static_cast<node_t*>(
+          intrusive_map::upcast<Left, Right, Tag>(pos));
+    }
+    index.insert(key, self);
+    return nullptr;
+  }
+  // Откат index_fresh, не бросает
+  template <typename Tag, typename Index, typename Key>
+  static void unindex_fresh(Index& index, node_t* prev, Key const& key) {
+    if (prev) {
+      index.assign(key, intrusive_map::downcast<Left, Right, Tag>(prev));
+    } else {
+      index.erase(key);
+    }
+  }
+
+  // Policy::journal: swap и присваивание меняют содержимое целиком, поэтому
+  // в журнал уходит clear и вставки всех пар (с LRU — от самой давней,
+  // чтобы реплика получила тот же порядок вытеснения)
+  void journal_contents() {
+    if (!journal_.enabled()) {
+      return;
+    }
+    journal_.record(intrusive_map::journal_op::clear);
+    if constexpr (lru_capacity > 0) {
+      for (auto const* link = lru_.oldest(); link != lru_.end();
+           link = link->next_) {
+        node_t const* node = from_link(link);
+        journal_.record(intrusive_map::journal_op::insert, node->left_value_,
+                        node->right_value_);
+      }
+    } else {
+      for (left_iterator it = begin_left(); it != end_left(); ++it) {
+        journal_.record(intrusive_map::journal_op::insert, *it,
+                        it.get_value());
+      }
+    }
+  }
+
+  // Новая вершина попадает в индексы сторон и в отпечаток. Если индекс
+  // бросает, уже сделанные записи откатываются
+  void index_node(node_t* node) {
+    left_index_.insert(
+        node->left_value_,
+        intrusive_map::downcast<Left, Right, intrusive_map::left_tag>(node));
+    try {
+      right_index_.insert(
+          node->right_value_,
+          intrusive_map::downcast<Left, Right, intrusive_map::right_tag>(
+              node));
+    } catch (...) {
+      left_index_.erase(node->left_value_);
+      throw;
+    }
+    fingerprint_.add(node->left_value_, node->right_value_);
+  }
+  // Обратное к index_node, не бросает
+  void unindex_node(node_t const* node) {
+    fingerprint_.remove(node->left_value_, node->right_value_);
+    left_index_.erase(node->left_value_);
+    right_index_.erase(node->right_value_);
+  }
+
+  // slot — ключ вершины node со стороны Tag, лежащей в map.
+  // Если key эквивалентен самому slot, перевешивать ничего не нужно.
+  // Сравнения и запись в индекс идут до того, как вершина сдвинется: если
+  // они бросают, ничего не меняется. Новое место запоминается как
+  // следующий за key элемент, поэтому перевешивание обходится без сравнений
+  template <typename Tag, typename Map, typename Index, typename Key>
+  bool replace_key(Map& map, Index& index, node_t* node, Key& slot,
+                   Key&& key) {
+    intrusive_map::base_node* self =
+        intrusive_map::downcast<Left, Right, Tag>(node);
+    intrusive_map::base_node* pos = map.find_impl(key);
+    int c = map.cmp(pos, key);
+    if (c == 0) {
+      if (pos != self) {
+        return false;
+      }
+      slot = std::move(key);
+      node->template refresh_prefix<Tag>();
+      return true;
+    }
+    intrusive_map::base_node* next = c > 0 ? pos : pos->next();
+    if (next == self) {
+      next = self->next();
+    }
+    index.insert(key, self);
+    index.erase(slot);
+    map.erase_impl(self);
+    self->unlink();
+    slot = std::move(key);
+    node->template refresh_prefix<Tag>();
+    map.insert_before(next, *node);
+    return true;
+  }
+
+  // Разбирает левое дерево от top правыми поворотами: O(n) без рекурсии и
+  // без дополнительной памяти на любой форме дерева. Правое дерево состоит
+  // из тех же вершин, и его ссылки не нужны
+  template <typename Destroy>
+  static void teardown(intrusive_map::base_node* top, Destroy destroy) {
+    while (top) {
+      if (intrusive_map::base_node* l = top->left_) {
+        top->left_ = l->right_;
+        l->right_ = top;
+        top = l;
+      } else {
+        intrusive_map::base_node* r = top->right_;
+        destroy(upcast_left(top));
+        top = r;
+      }
+    }
+  }
+
+  // Отцепленные деревья для фонового потока. Вместе с ними уходят блок
+  // compact() и индексы сторон, которые указывают на эти вершины
+  struct detached_nodes : intrusive_map::reclaim_job {
+    intrusive_map::base_node* top{nullptr};
+    arena_t arena;
+    left_index_t left_index;
+    right_index_t right_index;
+
+    void run() noexcept override {
+      teardown(top, [this](node_t const* node) {
+        if (arena.owns(node)) {
+          node->~node_t();
+          arena.deallocate(node);
+        } else {
+          delete node;
+        }
+      });
+    }
+  };
+
+  // После вызова деревья пусты, остальное состояние сбрасывает вызывающий
+  void release_nodes() noexcept {
+    if constexpr (Policy::background_reclaim_threshold > 0) {
+      if (size_ >= Policy::background_reclaim_threshold && defer_nodes()) {
+        return;
+      }
+    }
+    teardown(left_map_.root_.left_,
+             [this](node_t const* node) { destroy_node(node); });
+    left_map_.root_.left_ = nullptr;
+    right_map_.root_.left_ = nullptr;
+  }
+
+  // Вершины встроенного буфера лежат в самой bimap, поэтому удаляются
+  // сразу, а остальные передаются фоновому потоку. Освобождения переданных
+  // вершин не попадают в stats
+  bool defer_nodes() noexcept {
+    std::unique_ptr<detached_nodes> job;
+    try {
+      job = std::make_unique<detached_nodes>();
+    } catch (...) {
+      return false;
+    }
+    for (std::size_t i = 0; i < pool_.capacity(); i++) {
+      if (pool_.used(i)) {
+        node_t* node = pool_.slot(i);
+        left_map_.erase(left_iterator(
+            intrusive_map::downcast<Left, Right, intrusive_map::left_tag>(
+                node)));
+        right_map_.erase(right_iterator(
+            intrusive_map::downcast<Left, Right, intrusive_map::right_tag>(
+                node)));
+        destroy_node(node);
+      }
+    }
+    job->top = left_map_.root_.left_;
+    left_map_.root_.left_ = nullptr;
+    right_map_.root_.left_ = nullptr;
+    arena_.swap(job->arena);
+    left_index_.swap(job->left_index);
+    right_index_.swap(job->right_index);
+    lru_.detach();
+    intrusive_map::background_reclaimer::instance().post(std::move(job));
+    return true;
+  }
+
+  // Вершины сначала занимают встроенный буфер, и только потом кучу
+  template <typename L, typename R>
+  node_t* create_node(L&& left, R&& right) {
+    if (void* place = pool_.allocate()) {
+      try {
+        return new (place)
+            node_t(std::forward<L>(left), std::forward<R>(right));
+      } catch (...) {
+        pool_.deallocate(place);
+        throw;
+      }
+    }
+    stats_.on_allocate();
+    return new node_t(std::forward<L>(left), std::forward<R>(right));
+  }
+
+  void destroy_node(node_t const* node) {
+    if (pool_.owns(node)) {
+      node->~node_t();
+      pool_.deallocate(node);
       return;
     }
-    recursive_delete(ptr->left_);
-    recursive_delete(ptr->right_);
-    delete (upcast_left(ptr));
+    if (arena_.owns(node)) {
+      node->~node_t();
+      if (arena_.deallocate(node)) {
+        stats_.on_free();
+      }
+      return;
+    }
+    stats_.on_free();
+    delete node;
+  }
+
+  // Перемещает содержимое other в эту пустую bimap
+  void take(bimap& other) noexcept {
+    left_map_.swap(other.left_map_);
+    right_map_.swap(other.right_map_);
+    arena_.swap(other.arena_);
+    left_index_.swap(other.left_index_);
+    right_index_.swap(other.right_index_);
+    lru_.take(other.lru_);
+    fingerprint_.swap(other.fingerprint_);
+    std::swap(size_, other.size_);
+    adopt_inline_nodes(other);
+  }
+
+  // Конструктор перемещения base_node перевешивает родителя и детей на новую
+  // вершину в обоих деревьях, индексы сторон перевешиваются здесь
+  node_t* relocate_node(node_t* from, void* place) noexcept {
+    auto* to = new (place) node_t(std::move(*from));
+    left_index_.assign(
+        to->left_value_,
+        intrusive_map::downcast<Left, Right, intrusive_map::left_tag>(to));
+    right_index_.assign(
+        to->right_value_,
+        intrusive_map::downcast<Left, Right, intrusive_map::right_tag>(to));
+    return to;
+  }
+
+  // Деревья уже указывают на вершины из буфера other: конструктор перемещения
+  // base_node перевешивает родителя и детей на новую вершину в обоих деревьях
+  void adopt_inline_nodes(bimap& other) noexcept {
+    for (std::size_t i = 0; i < pool_.capacity(); i++) {
+      if (other.pool_.used(i)) {
+        node_t* from = other.pool_.slot(i);
+        relocate_node(from, pool_.allocate());
+        from->~node_t();
+        other.pool_.deallocate(from);
+      }
+    }
   }
 
-  intrusive_map::bimap_node<Left, Right> const*
-  upcast_left(intrusive_map::base_node const* p) {
-    return intrusive_map::upcast<Left, Right, intrusive_map::left_tag>(p);
+  static node_t const* upcast_left(intrusive_map::base_node const* p) {
+    return static_cast<node_t const*>(
+        intrusive_map::upcast<Left, Right, intrusive_map::left_tag>(p));
   }
 
-  intrusive_map::bimap_node<Left, Right>*
-  upcast_left(intrusive_map::base_node* p) {
-    return intrusive_map::upcast<Left, Right, intrusive_map::left_tag>(p);
+  static node_t* upcast_left(intrusive_map::base_node* p) {
+    return static_cast<node_t*>(
+        intrusive_map::upcast<Left, Right, intrusive_map::left_tag>(p));
   }
 
-  intrusive_map::bimap_node<Left, Right> const*
-  upcast_right(intrusive_map::base_node const* p) {
-    return intrusive_map::upcast<Left, Right, intrusive_map::right_tag>(p);
+  static node_t const* upcast_right(intrusive_map::base_node const* p) {
+    return static_cast<node_t const*>(
+        intrusive_map::upcast<Left, Right, intrusive_map::right_tag>(p));
   }
 
-  intrusive_map::bimap_node<Left, Right>*
-  upcast_right(intrusive_map::base_node* p) {
-    return intrusive_map::upcast<Left, Right, intrusive_map::right_tag>(p);
+  static node_t* upcast_right(intrusive_map::base_node* p) {
+    return static_cast<node_t*>(
+        intrusive_map::upcast<Left, Right, intrusive_map::right_tag>(p));
   }
 };
+
+// Аналог std::erase_if, см. bimap::erase_if
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename Policy, typename Pred>
+std::size_t erase_if(bimap<Left, Right, CompareLeft, CompareRight, Policy>& b,
+                     Pred pred) {
+  return b.erase_if(std::move(pred));
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "bimap.h"
+#include <utility>
+#include <vector>
+
+namespace intrusive_map {
+// Что делать с парами, у которых left совпадает, а right различается
+enum class conflict_policy {
+  take_first,  // взять пару из первой bimap
+  take_second, // взять пару из второй bimap
+  drop,        // не брать ни одну
+};
+
+// Разница между двумя версиями bimap, см. diff
+template <typename Left, typename Right>
+struct bimap_diff {
+  struct change {
+    Left left;
+    Right from;
+    Right to;
+  };
+
+  std::vector<std::pair<Left, Right>> added;   // left есть только во второй
+  std::vector<std::pair<Left, Right>> removed; // left есть только в первой
+  std::vector<change> changed;                 // у left сменился right
+
+  bool empty() const {
+    return added.empty() && removed.empty() && changed.empty();
+  }
+};
+
+// Сливает левые стороны a и b за O(n + m), вызывая
+// on_first(it) / on_second(it) / on_both(it1, it2) по порядку left
+template <typename Bimap, typename OnFirst, typename OnSecond, typename OnBoth>
+void merge_walk_left(Bimap const& a, Bimap const& b, OnFirst on_first,
+                     OnSecond on_second, OnBoth on_both) {
+  auto comp = a.key_comp_left();
+  auto it1 = a.begin_left();
+  auto it2 = b.begin_left();
+  while (it1 != a.end_left() && it2 != b.end_left()) {
+    int c = compare_keys(comp, *it1, *it2);
+    if (c < 0) {
+      on_first(it1++);
+    } else if (c > 0) {
+      on_second(it2++);
+    } else {
+      on_both(it1++, it2++);
+    }
+  }
+  for (; it1 != a.end_left(); ++it1) {
+    on_first(it1);
+  }
+  for (; it2 != b.end_left(); ++it2) {
+    on_second(it2);
+  }
+}
+
+template <typename Bimap, typename It>
+bool same_right(Bimap const& a, It it1, It it2) {
+  return compare_keys(a.key_comp_right(), it1.get_value(),
+                      it2.get_value()) == 0;
+}
+
+template <typename Left, typename Right>
+using pair_refs = std::vector<std::pair<Left const&, Right const&>>;
+} // namespace intrusive_map
+
+// Операции над множествами пар. Результат собирается одним проходом слияния
+// по левым сторонам и строится через конструктор sorted_unique, компараторы
+// берутся из a. Если в результат попадают две пары с одинаковым right,
+// остается пара с меньшим left.
+
+// Все пары a и b
+template <typename L, typename R, typename CL, typename CR, typename P>
+bimap<L, R, CL, CR, P> merge_union(
+    bimap<L, R, CL, CR, P> const& a, bimap<L, R, CL, CR, P> const& b,
+    intrusive_map::conflict_policy on_conflict =
+        intrusive_map::conflict_policy::take_first) {
+  using intrusive_map::conflict_policy;
+  intrusive_map::pair_refs<L, R> res;
+  auto take = [&res](auto it) { res.emplace_back(*it, it.get_value()); };
+  intrusive_map::merge_walk_left(
+      a, b, take, take, [&](auto it1, auto it2) {
+        if (intrusive_map::same_right(a, it1, it2) ||
+            on_conflict == conflict_policy::take_first) {
+          take(it1);
+        } else if (on_conflict == conflict_policy::take_second) {
+          take(it2);
+        }
+      });
+  return bimap<L, R, CL, CR, P>(intrusive_map::sorted_unique, res.begin(),
+                                res.end(), a.key_comp_left(),
+                                a.key_comp_right());
+}
+
+// Пары, left которых есть и в a, и в b
+template <typename L, typename R, typename CL, typename CR, typename P>
+bimap<L, R, CL, CR, P> intersect(
+    bimap<L, R, CL, CR, P> const& a, bimap<L, R, CL, CR, P> const& b,
+    intrusive_map::conflict_policy on_conflict =
+        intrusive_map::conflict_policy::drop) {
+  using intrusive_map::conflict_policy;
+  intrusive_map::pair_refs<L, R> res;
+  auto skip = [](auto) {};
+  intrusive_map::merge_walk_left(a, b, skip, skip, [&](auto it1, auto it2) {
+    if (intrusive_map::same_right(a, it1, it2) ||
+        on_conflict == conflict_policy::take_first) {
+      res.emplace_back(*it1, it1.get_value());
+    } else if (on_conflict == conflict_policy::take_second) {
+      res.emplace_back(*it2, it2.get_value());
+    }
+  });
+  return bimap<L, R, CL, CR, P>(intrusive_map::sorted_unique, res.begin(),
+                                res.end(), a.key_comp_left(),
+                                a.key_comp_right());
+}
+
+// Пары a, которых нет в b. Пара a, у которой left есть в b с другим right,
+// остается при take_first и выбрасывается иначе
+template <typename L, typename R, typename CL, typename CR, typename P>
+bimap<L, R, CL, CR, P> difference(
+    bimap<L, R, CL, CR, P> const& a, bimap<L, R, CL, CR, P> const& b,
+    intrusive_map::conflict_policy on_conflict =
+        intrusive_map::conflict_policy::drop) {
+  using intrusive_map::conflict_policy;
+  intrusive_map::pair_refs<L, R> res;
+  intrusive_map::merge_walk_left(
+      a, b, [&res](auto it) { res.emplace_back(*it, it.get_value()); },
+      [](auto) {},
+      [&](auto it1, auto it2) {
+        if (!intrusive_map::same_right(a, it1, it2) &&
+            on_conflict == conflict_policy::take_first) {
+          res.emplace_back(*it1, it1.get_value());
+        }
+      });
+  return bimap<L, R, CL, CR, P>(intrusive_map::sorted_unique, res.begin(),
+                                res.end(), a.key_comp_left(),
+                                a.key_comp_right());
+}
+
+// Изменения, превращающие a в b, за один проход
+template <typename L, typename R, typename CL, typename CR, typename P>
+intrusive_map::bimap_diff<L, R> diff(bimap<L, R, CL, CR, P> const& a,
+                                     bimap<L, R, CL, CR, P> const& b) {
+  intrusive_map::bimap_diff<L, R> res;
+  intrusive_map::merge_walk_left(
+      a, b,
+      [&res](auto it) { res.removed.emplace_back(*it, it.get_value()); },
+      [&res](auto it) { res.added.emplace_back(*it, it.get_value()); },
+      [&](auto it1, auto it2) {
+        if (!intrusive_map::same_right(a, it1, it2)) {
+          res.changed.push_back({*it1, it1.get_value(), it2.get_value()});
+        }
+      });
+  return res;
+}
+
+// Композиция A <-> B и B <-> C в A <-> C. Правая сторона ab и левая сторона
+// bc сливаются за O(n + m) (порядки на B у них должны совпадать), затем
+// найденные пары сортируются по A для построения результата.
+// Пары, для которых B есть только в одной из bimap, отбрасываются
+template <typename A, typename B, typename C, typename CA, typename CB1,
+          typename CB2, typename CC, typename P1, typename P2>
+bimap<A, C, CA, CC, P1> compose(bimap<A, B, CA, CB1, P1> const& ab,
+                                bimap<B, C, CB2, CC, P2> const& bc) {
+  std::vector<std::pair<A const*, C const*>> joined;
+  auto comp = ab.key_comp_right();
+  auto it1 = ab.begin_right();
+  auto it2 = bc.begin_left();
+  while (it1 != ab.end_right() && it2 != bc.end_left()) {
+    int c = intrusive_map::compare_keys(comp, *it1, *it2);
+    if (c < 0) {
+      ++it1;
+    } else if (c > 0) {
+      ++it2;
+    } else {
+      joined.emplace_back(&it1.get_value(), &it2.get_value());
+      ++it1;
+      ++it2;
+    }
+  }
+  std::sort(joined.begin(), joined.end(),
+            [comp_a = ab.key_comp_left()](auto const& x, auto const& y) {
+              return intrusive_map::compare_keys(comp_a, *x.first,
+                                                 *y.first) < 0;
+            });
+  intrusive_map::pair_refs<A, C> res;
+  res.reserve(joined.size());
+  for (auto const& p : joined) {
+    res.emplace_back(*p.first, *p.second);
+  }
+  return bimap<A, C, CA, CC, P1>(intrusive_map::sorted_unique, res.begin(),
+                                 res.end(), ab.key_comp_left(),
+                                 bc.key_comp_right());
+}
+
+namespace intrusive_map {
+// Ленивая композиция: ничего не строит и отвечает на at_left/at_right двумя
+// поисками. Хранит ссылки, поэтому не должна переживать first и second.
+// Сами first и second могут быть как bimap, так и другими composed_view
+template <typename First, typename Second>
+class composed_view {
+public:
+  composed_view(First const& first, Second const& second)
+      : first_(first), second_(second) {}
+
+  // Бросают std::out_of_range, если ключа нет на любом из шагов
+  template <typename Key>
+  decltype(auto) at_left(Key const& key) const {
+    return second_.at_left(first_.at_left(key));
+  }
+  template <typename Key>
+  decltype(auto) at_right(Key const& key) const {
+    return first_.at_right(second_.at_right(key));
+  }
+
+private:
+  First const& first_;
+  Second const& second_;
+};
+} // namespace intrusive_map
+
+template <typename First, typename Second>
+intrusive_map::composed_view<First, Second> compose_view(First const& first,
+                                                         Second const& second) {
+  return {first, second};
+}
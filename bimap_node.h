@@ -1,5 +1,7 @@
 #pragma once
 
+#include "bimap_policy.h"
+#include "recency_list.h"
 #include <algorithm>
 #include <type_traits>
 
@@ -116,6 +118,74 @@ struct bimap_node : empty_bimap_node {
   }
 };
 
+// Вершина с данными, которые включает политика bimap (см. bimap_policy.h):
+// префиксы ключей и агрегаты аугментации для каждой стороны и звено списка
+// давности. Они — базы, идущие перед bimap_node, так что в памяти лежат
+// вплотную к ссылкам деревьев. С политикой по умолчанию все базы пустые и
+// вершина не больше bimap_node
+template <typename Left, typename Right, typename Policy = default_policy>
+struct policy_bimap_node
+    : prefix_slot<left_tag, Left, typename Policy::left_prefix>,
+      prefix_slot<right_tag, Right, typename Policy::right_prefix>,
+      augment_slot<left_tag, typename Policy::left_augment>,
+      augment_slot<right_tag, typename Policy::right_augment>,
+      recency_slot<(Policy::lru_capacity > 0)>,
+      bimap_node<Left, Right> {
+  template <typename Tag>
+  using key_t = typename map_key<Left, Right, Tag>::key_t;
+
+  template <typename Tag>
+  using prefix_extractor_t =
+      std::conditional_t<std::is_same_v<Tag, left_tag>,
+                         typename Policy::left_prefix,
+                         typename Policy::right_prefix>;
+  template <typename Tag>
+  using prefix_slot_t = prefix_slot<Tag, key_t<Tag>, prefix_extractor_t<Tag>>;
+  template <typename Tag>
+  static constexpr bool has_prefix =
+      !std::is_same_v<prefix_extractor_t<Tag>, no_prefix>;
+
+  template <typename Tag>
+  using augment_t = std::conditional_t<std::is_same_v<Tag, left_tag>,
+                                       typename Policy::left_augment,
+                                       typename Policy::right_augment>;
+  template <typename Tag>
+  using augment_slot_t = augment_slot<Tag, augment_t<Tag>>;
+  template <typename Tag>
+  static constexpr bool has_augment =
+      !std::is_same_v<augment_t<Tag>, no_augment>;
+
+  template <typename L, typename R>
+  policy_bimap_node(L&& left, R&& right)
+      : bimap_node<Left, Right>(std::forward<L>(left), std::forward<R>(right)) {
+    refresh_prefix<left_tag>();
+    refresh_prefix<right_tag>();
+  }
+
+  template <typename Tag>
+  auto const& prefix() const {
+    return static_cast<prefix_slot_t<Tag> const&>(*this).prefix_;
+  }
+
+  // Пересчитывает префикс после изменения ключа со стороны Tag
+  template <typename Tag>
+  void refresh_prefix() {
+    if constexpr (has_prefix<Tag>) {
+      static_cast<prefix_slot_t<Tag>&>(*this).prefix_ =
+          prefix_extractor_t<Tag>()(this->template get_key<Tag>());
+    }
+  }
+
+  template <typename Tag>
+  auto& aggregate() {
+    return static_cast<augment_slot_t<Tag>&>(*this).aggregate_;
+  }
+  template <typename Tag>
+  auto const& aggregate() const {
+    return static_cast<augment_slot_t<Tag> const&>(*this).aggregate_;
+  }
+};
+
 template <typename Left, typename Right, typename Tag>
 bimap_node<Left, Right> const* upcast(base_node const* ptr) {
   return static_cast<bimap_node<Left, Right> const*>(
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "augment.h"
+#include "bimap_stats.h"
+#include "dense_index.h"
+#include "key_prefix.h"
+#include "radix_index.h"
+#include <cstddef>
+
+namespace intrusive_map {
+// Политика bimap по умолчанию. Чтобы включить опцию, достаточно унаследоваться
+// и переопределить нужный член, например
+//   struct my_policy : intrusive_map::default_policy {
+//     using stats = intrusive_map::counting_stats;
+//   };
+//   bimap<int, int, std::less<int>, std::less<int>, my_policy> b;
+struct default_policy {
+  // Счетчики сравнений, глубины поиска, аллокаций и перестроек
+  using stats = no_stats;
+  // Сколько вершин (не больше 64) хранится прямо в объекте bimap без
+  // обращения к куче
+  static constexpr std::size_t inline_capacity = 0;
+  // Экстракторы префиксов ключей, хранимых в вершинах (см. key_prefix.h),
+  // например string_prefix для std::string с std::less
+  using left_prefix = no_prefix;
+  using right_prefix = no_prefix;
+  // Моноиды для запросов aggregate_left / aggregate_right (см. augment.h):
+  // left_augment агрегирует right по отрезку left, right_augment — наоборот
+  using left_augment = no_augment;
+  using right_augment = no_augment;
+  // find_left / find_right начинают поиск от последнего найденного элемента
+  // своей стороны, что выгодно при обращениях к близким ключам. Палец
+  // обновляется и в const find_* / at_*, поэтому с этой опцией
+  // одновременные чтения одной bimap из разных потоков — гонка
+  static constexpr bool remember_finger = false;
+  // Число слотов кэша hash(key) -> вершина перед каждым деревом
+  // (см. lookup_cache.h), ключи должны поддерживать std::hash. Слоты и
+  // счетчики попаданий пишутся и в const find_* / at_*, поэтому с кэшем
+  // одновременные чтения одной bimap из разных потоков — гонка
+  static constexpr std::size_t lookup_cache_size = 0;
+  // Индексы сторон для find / lower_bound / upper_bound: radix_index для
+  // целых и строк с std::less (см. radix_index.h) или dense_index<Lo, Hi>
+  // для плотных целых ключей (см. dense_index.h)
+  using left_index = no_index;
+  using right_index = no_index;
+  // Если не 0 — наибольшее число пар: при вставке в полную bimap вытесняется
+  // пара, к которой дольше всех не обращались через find_* / at_* (см.
+  // recency_list.h и bimap::on_evict). Список давности переставляется и в
+  // const find_* / at_*, поэтому с этой опцией одновременные чтения одной
+  // bimap из разных потоков — гонка
+  static constexpr std::size_t lru_capacity = 0;
+  // Успешные insert, erase и замены ключей (в том числе из at_*_or_default)
+  // пишутся записями в sink, заданный bimap::journal_to (см. journal.h)
+  static constexpr bool journal = false;
+  // bimap::fingerprint() — отпечаток множества пар, поддерживаемый при каждой
+  // мутации (см. fingerprint.h). operator== сначала сравнивает отпечатки.
+  // Ключи должны поддерживать std::hash
+  static constexpr bool track_fingerprint = false;
+  // bimap::compact() переносит вершины в один непрерывный блок в порядке
+  // обхода (см. node_arena в node_pool.h)
+  static constexpr bool compactable = false;
+  // Если не 0 — bimap хотя бы с таким числом пар при разрушении, clear и
+  // присваивании поверх нее отдает вершины фоновому потоку (см.
+  // reclaimer.h), и деструкторы ключей выполняются в нем
+  static constexpr std::size_t background_reclaim_threshold = 0;
+};
+} // namespace intrusive_map
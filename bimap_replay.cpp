@@ -0,0 +1,246 @@
+// Воспроизводит трассу traced_bimap (см. trace.h) на bimap в нескольких
+// конфигурациях и печатает пропускную способность, перцентили задержки
+// операции и пик памяти, выделенной за время воспроизведения.
+// Использование: bimap_replay trace [повторов]
+
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+// Учет памяти: каждый блок хранит свой размер перед данными
+std::size_t allocated = 0;
+std::size_t peak = 0;
+constexpr std::size_t header = alignof(std::max_align_t);
+
+void* counted_alloc(std::size_t size) {
+  auto* p = static_cast<char*>(std::malloc(size + header));
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  *reinterpret_cast<std::size_t*>(p) = size;
+  allocated += size;
+  peak = std::max(peak, allocated);
+  return p + header;
+}
+
+void counted_free(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  char* p = static_cast<char*>(ptr) - header;
+  allocated -= *reinterpret_cast<std::size_t*>(p);
+  std::free(p);
+}
+} // namespace
+
+void* operator new(std::size_t size) {
+  return counted_alloc(size);
+}
+void* operator new[](std::size_t size) {
+  return counted_alloc(size);
+}
+void operator delete(void* ptr) noexcept {
+  counted_free(ptr);
+}
+void operator delete[](void* ptr) noexcept {
+  counted_free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept {
+  counted_free(ptr);
+}
+void operator delete[](void* ptr, std::size_t) noexcept {
+  counted_free(ptr);
+}
+
+namespace {
+struct finger_policy : intrusive_map::default_policy {
+  static constexpr bool remember_finger = true;
+};
+struct cache_policy : intrusive_map::default_policy {
+  static constexpr std::size_t lookup_cache_size = 1024;
+};
+struct radix_policy : intrusive_map::default_policy {
+  using left_index = intrusive_map::radix_index;
+  using right_index = intrusive_map::radix_index;
+};
+
+template <typename Left, typename Right>
+using records = std::vector<intrusive_map::trace_record<Left, Right>>;
+
+// Одна операция трассы. Результат накапливается в sink, чтобы компилятор
+// не выбросил поиск
+template <typename Bimap, typename Record>
+void play(Bimap& b, Record const& rec, std::size_t& sink) {
+  using intrusive_map::trace_op;
+  switch (rec.op) {
+  case trace_op::insert:
+    sink += b.insert(rec.left, rec.right) != b.end_left();
+    break;
+  case trace_op::erase_left:
+    sink += b.erase_left(rec.left);
+    break;
+  case trace_op::erase_right:
+    sink += b.erase_right(rec.right);
+    break;
+  case trace_op::find_left:
+    sink += b.find_left(rec.left) != b.end_left();
+    break;
+  case trace_op::find_right:
+    sink += b.find_right(rec.right) != b.end_right();
+    break;
+  case trace_op::at_left:
+  case trace_op::at_right:
+    try {
+      if (rec.op == trace_op::at_left) {
+        b.at_left(rec.left);
+      } else {
+        b.at_right(rec.right);
+      }
+      sink++;
+    } catch (std::out_of_range const&) {
+    }
+    break;
+  case trace_op::lower_bound_left:
+    sink += b.lower_bound_left(rec.left) != b.end_left();
+    break;
+  case trace_op::upper_bound_left:
+    sink += b.upper_bound_left(rec.left) != b.end_left();
+    break;
+  case trace_op::lower_bound_right:
+    sink += b.lower_bound_right(rec.right) != b.end_right();
+    break;
+  case trace_op::upper_bound_right:
+    sink += b.upper_bound_right(rec.right) != b.end_right();
+    break;
+  case trace_op::scan_left: {
+    auto it = b.lower_bound_left(rec.left);
+    for (std::size_t i = 0; i < rec.steps && it != b.end_left(); ++i, ++it) {
+      sink++;
+    }
+    break;
+  }
+  case trace_op::scan_right: {
+    auto it = b.lower_bound_right(rec.right);
+    for (std::size_t i = 0; i < rec.steps && it != b.end_right(); ++i, ++it) {
+      sink++;
+    }
+    break;
+  }
+  }
+}
+
+template <typename Policy, typename Left, typename Right>
+void run(char const* name, records<Left, Right> const& trace,
+         std::size_t repeat) {
+  using clock = std::chrono::steady_clock;
+  std::vector<std::uint64_t> latencies;
+  latencies.reserve(trace.size() * repeat);
+  std::size_t sink = 0;
+  std::size_t max_memory = 0;
+  clock::duration total{};
+  for (std::size_t r = 0; r < repeat; r++) {
+    std::size_t base = allocated;
+    peak = allocated;
+    auto start = clock::now();
+    {
+      bimap<Left, Right, std::less<Left>, std::less<Right>, Policy> b;
+      for (auto const& rec : trace) {
+        auto op_start = clock::now();
+        play(b, rec, sink);
+        latencies.push_back(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock::now() - op_start)
+                .count()));
+      }
+      total += clock::now() - start;
+    }
+    max_memory = std::max(max_memory, peak - base);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    return latencies.empty()
+               ? 0
+               : latencies[static_cast<std::size_t>(
+                     p * static_cast<double>(latencies.size() - 1))];
+  };
+  double seconds = std::chrono::duration<double>(total).count();
+  std::cout << name << ": "
+            << static_cast<double>(latencies.size()) / seconds << " ops/s, "
+            << "p50 " << percentile(0.5) << " ns, p99 " << percentile(0.99)
+            << " ns, p99.9 " << percentile(0.999) << " ns, max "
+            << percentile(1.0) << " ns, peak memory " << max_memory
+            << " bytes (" << sink << ")\n";
+}
+
+template <typename Left, typename Right>
+void replay_all(std::string_view in, std::size_t repeat) {
+  records<Left, Right> trace;
+  intrusive_map::trace_record<Left, Right> rec;
+  while (intrusive_map::read_trace_record(in, rec)) {
+    trace.push_back(rec);
+  }
+  std::cout << trace.size() << " operations, " << repeat << " runs\n";
+  run<intrusive_map::default_policy>("default", trace, repeat);
+  run<finger_policy>("remember_finger", trace, repeat);
+  run<cache_policy>("lookup_cache_size 1024", trace, repeat);
+  run<radix_policy>("radix_index", trace, repeat);
+}
+
+template <typename F>
+void with_key_type(char tag, F f) {
+  switch (tag) {
+  case 'i':
+    f(std::int64_t());
+    break;
+  case 'u':
+  case 'h':
+    f(std::uint64_t());
+    break;
+  case 's':
+    f(std::string());
+    break;
+  default:
+    throw std::invalid_argument("unknown key type in trace header");
+  }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "usage: bimap_replay trace [repeat]\n";
+    return 1;
+  }
+  std::ifstream file(argv[1], std::ios::binary);
+  if (!file) {
+    std::cerr << "cannot open " << argv[1] << "\n";
+    return 1;
+  }
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  std::size_t repeat = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 3;
+  if (repeat == 0) {
+    repeat = 1;
+  }
+  try {
+    std::string_view in = data;
+    intrusive_map::trace_header header = intrusive_map::read_trace_header(in);
+    with_key_type(header.left_tag, [&](auto left) {
+      with_key_type(header.right_tag, [&](auto right) {
+        replay_all<decltype(left), decltype(right)>(in, repeat);
+      });
+    });
+  } catch (std::exception const& e) {
+    std::cerr << "bad trace: " << e.what() << "\n";
+    return 1;
+  }
+}
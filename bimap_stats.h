@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace intrusive_map {
+// Политика статистики по умолчанию: все хуки пустые, а объект не занимает
+// места (хранится через [[no_unique_address]]), так что компилятор вырезает
+// инструментацию целиком
+struct no_stats {
+  static constexpr bool enabled = false;
+
+  void on_compare() const noexcept {}
+  void on_search(std::size_t) const noexcept {}
+  void on_allocate() const noexcept {}
+  void on_free() const noexcept {}
+  void on_restructure() const noexcept {}
+};
+
+// Счетчики горячего пути. Каждое дерево bimap ведет свой экземпляр
+// (сравнения, длины путей поиска, перестройки связей),
+// а сама bimap — свой (аллокации и освобождения вершин)
+struct counting_stats {
+  static constexpr bool enabled = true;
+  // depth_histogram[d] — число поисков, прошедших d вершин,
+  // последняя корзина собирает все более длинные пути
+  static constexpr std::size_t histogram_size = 64;
+
+  std::size_t comparisons{0};
+  std::size_t searches{0};
+  std::size_t total_depth{0};
+  std::size_t max_depth{0};
+  std::array<std::size_t, histogram_size> depth_histogram{};
+  std::size_t allocations{0};
+  std::size_t frees{0};
+  std::size_t restructures{0};
+
+  void on_compare() noexcept {
+    comparisons++;
+  }
+  void on_search(std::size_t depth) noexcept {
+    searches++;
+    total_depth += depth;
+    max_depth = std::max(max_depth, depth);
+    depth_histogram[std::min(depth, histogram_size - 1)]++;
+  }
+  void on_allocate() noexcept {
+    allocations++;
+  }
+  void on_free() noexcept {
+    frees++;
+  }
+  void on_restructure() noexcept {
+    restructures++;
+  }
+
+  double average_depth() const noexcept {
+    return searches == 0 ? 0.0
+                         : static_cast<double>(total_depth) /
+                               static_cast<double>(searches);
+  }
+};
+
+// Снимок статистики bimap, возвращается bimap::stats()
+template <typename Stats>
+struct bimap_stats {
+  Stats left;
+  Stats right;
+  Stats nodes;
+};
+// Форма одного дерева: levels[d] — число вершин на глубине d (корень на
+// глубине 0), height — число уровней
+struct tree_shape {
+  std::size_t size{0};
+  std::size_t height{0};
+  std::size_t total_depth{0};
+  std::vector<std::size_t> levels;
+
+  std::size_t max_depth() const noexcept {
+    return height == 0 ? 0 : height - 1;
+  }
+  double average_depth() const noexcept {
+    return size == 0 ? 0.0
+                     : static_cast<double>(total_depth) /
+                           static_cast<double>(size);
+  }
+  // Во сколько раз дерево выше идеально сбалансированного с тем же
+  // числом вершин, 1.0 — идеальный баланс
+  double imbalance() const noexcept {
+    std::size_t optimal = 0;
+    while ((std::size_t(1) << optimal) <= size) {
+      optimal++;
+    }
+    return optimal == 0 ? 1.0
+                        : static_cast<double>(height) /
+                              static_cast<double>(optimal);
+  }
+};
+} // namespace intrusive_map
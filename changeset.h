@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace intrusive_map {
+// Пачка изменений для bimap::apply. Пачка применяется целиком как одно
+// изменение, а не как последовательность insert / erase: по каждому left
+// учитывается только последняя операция, а upsert забирает свой right у
+// пары, которая держала его до пачки. Поэтому две пары могут обменяться
+// right в одной пачке
+template <typename Left, typename Right>
+class changeset {
+public:
+  struct entry {
+    Left left;
+    std::optional<Right> right; // nullopt — удаление
+  };
+
+  // После применения left связан с right
+  void upsert(Left left, Right right) {
+    entries_.push_back({std::move(left), std::move(right)});
+  }
+  // После применения пары с этим left нет
+  void erase(Left left) {
+    entries_.push_back({std::move(left), std::nullopt});
+  }
+
+  void reserve(std::size_t n) {
+    entries_.reserve(n);
+  }
+  void clear() {
+    entries_.clear();
+  }
+  std::size_t size() const {
+    return entries_.size();
+  }
+  bool empty() const {
+    return entries_.empty();
+  }
+
+  std::vector<entry>& entries() {
+    return entries_;
+  }
+  std::vector<entry> const& entries() const {
+    return entries_;
+  }
+
+private:
+  std::vector<entry> entries_;
+};
+} // namespace intrusive_map
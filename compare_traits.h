@@ -0,0 +1,76 @@
+#pragma once
+
+#include <compare>
+#include <concepts>
+#include <functional>
+#include <type_traits>
+
+namespace intrusive_map {
+// Трехсторонний компаратор отвечает на вопрос "меньше, равно или больше"
+// одним вызовом вместо двух вызовов a < b и b < a.
+// Распознаются:
+// * компараторы с методом three_way(a, b), возвращающим *_ordering —
+//   явный opt-in, operator() при этом может оставаться булевым;
+// * компараторы, у которых сам operator() возвращает *_ordering;
+// * std::less / std::greater (в том числе прозрачные) над типами с
+//   operator<=>, для них используется std::compare_three_way.
+template <typename Compare, typename Key>
+struct is_three_way {
+  static constexpr bool value =
+      requires(Compare const& c, Key const& a, Key const& b) {
+        { c.three_way(a, b) } -> std::convertible_to<std::partial_ordering>;
+      } ||
+      requires(Compare const& c, Key const& a, Key const& b) {
+        { c(a, b) } -> std::convertible_to<std::partial_ordering>;
+      } ||
+      ((std::is_same_v<Compare, std::less<Key>> ||
+        std::is_same_v<Compare, std::less<>> ||
+        std::is_same_v<Compare, std::greater<Key>> ||
+        std::is_same_v<Compare, std::greater<>>) &&
+       std::three_way_comparable<Key>);
+};
+
+template <typename Compare, typename Key>
+inline constexpr bool is_three_way_v = is_three_way<Compare, Key>::value;
+
+// returns -1 a < b; 0 a == b (или несравнимы); 1 a > b
+template <typename Compare, typename Key>
+int three_way_compare(Compare const& c, Key const& a, Key const& b) {
+  std::partial_ordering res = std::partial_ordering::equivalent;
+  if constexpr (requires { c.three_way(a, b); }) {
+    res = c.three_way(a, b);
+  } else if constexpr (std::is_convertible_v<decltype(c(a, b)),
+                                             std::partial_ordering>) {
+    res = c(a, b);
+  } else if constexpr (std::is_same_v<Compare, std::greater<Key>> ||
+                       std::is_same_v<Compare, std::greater<>>) {
+    res = std::compare_three_way()(b, a);
+  } else {
+    res = std::compare_three_way()(a, b);
+  }
+  if (res < 0) {
+    return -1;
+  }
+  if (res > 0) {
+    return 1;
+  }
+  return 0;
+}
+
+// Сравнение ключей вне дерева: один вызов для трехсторонних компараторов,
+// иначе a < b и b < a
+template <typename Compare, typename Key>
+int compare_keys(Compare const& c, Key const& a, Key const& b) {
+  if constexpr (is_three_way_v<Compare, Key>) {
+    return three_way_compare(c, a, b);
+  } else {
+    if (c(a, b)) {
+      return -1;
+    }
+    if (c(b, a)) {
+      return 1;
+    }
+    return 0;
+  }
+}
+} // namespace intrusive_map
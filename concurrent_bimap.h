@@ -0,0 +1,260 @@
+#pragma once
+
+#include "bimap.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Потокобезопасная обертка над bimap с flat combining: поток публикует
+// операцию в свободный слот и ждет, а тот, кто успел захватить мьютекс
+// (комбайнер), применяет к деревьям сразу все опубликованные операции.
+// Мьютекс переходит из рук в руки один раз на пачку, а не на операцию, и
+// деревья трогает один поток, пока они горячие в его кэше. Пачка
+// сортируется по ключам, чтобы соседние спуски find_impl шли по одному
+// пути. Операции одной пачки одновременны, поэтому любой их порядок
+// линеаризуем. Ключи передаются по ссылке и живут, пока поток ждет.
+// Исключение из операции (компаратор, копия ключа, нехватка памяти)
+// запоминается в ее слоте и бросается в потоке, который ее опубликовал
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Policy = intrusive_map::default_policy>
+class concurrent_bimap {
+  using bimap_t = bimap<Left, Right, CompareLeft, CompareRight, Policy>;
+
+public:
+  // Число слотов публикации. Если одновременно работает больше потоков,
+  // лишние ждут освобождения слота
+  static constexpr std::size_t slot_count = 64;
+  static constexpr std::size_t combine_passes = 4;
+
+  concurrent_bimap(CompareLeft compare_left = CompareLeft(),
+                   CompareRight compare_right = CompareRight())
+      : bimap_(std::move(compare_left), std::move(compare_right)) {
+    batch_.reserve(slot_count);
+  }
+
+  concurrent_bimap(concurrent_bimap const&) = delete;
+  concurrent_bimap& operator=(concurrent_bimap const&) = delete;
+
+  // Возвращает, была ли вставлена пара
+  bool insert(Left const& left, Right const& right) {
+    return finish(publish(op::insert, &left, &right));
+  }
+  // Возвращают, была ли пара удалена
+  bool erase_left(Left const& left) {
+    return finish(publish(op::erase_left, &left, nullptr));
+  }
+  bool erase_right(Right const& right) {
+    return finish(publish(op::erase_right, nullptr, &right));
+  }
+  // Копия парного ключа или nullopt
+  std::optional<Right> find_left(Left const& left) {
+    std::optional<Right> res;
+    slot& s = publish(op::find_left, &left, nullptr);
+    s.right_out = &res;
+    finish(s);
+    return res;
+  }
+  std::optional<Left> find_right(Right const& right) {
+    std::optional<Left> res;
+    slot& s = publish(op::find_right, nullptr, &right);
+    s.left_out = &res;
+    finish(s);
+    return res;
+  }
+
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bimap_.size();
+  }
+
+  // Доступ к bimap под мьютексом комбайнера, например для обхода
+  template <typename F>
+  decltype(auto) with_locked(F&& f) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::forward<F>(f)(static_cast<bimap_t const&>(bimap_));
+  }
+
+  // Сколько раз комбайнер применял пачку и сколько операций в них было
+  std::size_t batches() const {
+    return batches_.load(std::memory_order_relaxed);
+  }
+  std::size_t combined() const {
+    return combined_.load(std::memory_order_relaxed);
+  }
+
+private:
+  enum class op : unsigned char {
+    insert,
+    erase_left,
+    erase_right,
+    find_left,
+    find_right
+  };
+  // free -> claimed (слот занят потоком) -> pending (операция опубликована)
+  // -> done (результат записан комбайнером) -> free
+  enum class state : unsigned char { free, claimed, pending, done };
+
+  struct alignas(64) slot {
+    std::atomic<state> state_{state::free};
+    op op_{};
+    bool found{false};
+    Left const* left{nullptr};
+    Right const* right{nullptr};
+    std::optional<Right>* right_out{nullptr};
+    std::optional<Left>* left_out{nullptr};
+    std::exception_ptr error;
+  };
+
+  // Стартовый слот зависит от потока, чтобы потоки не толкались на одном
+  slot& claim() {
+    std::size_t i = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (;; i++) {
+      slot& s = slots_[i % slot_count];
+      state expected = state::free;
+      if (s.state_.load(std::memory_order_relaxed) == state::free &&
+          s.state_.compare_exchange_weak(expected, state::claimed,
+                                         std::memory_order_acquire)) {
+        return s;
+      }
+      if (i % slot_count == slot_count - 1) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  slot& publish(op o, Left const* left, Right const* right) {
+    slot& s = claim();
+    s.op_ = o;
+    s.left = left;
+    s.right = right;
+    s.right_out = nullptr;
+    s.left_out = nullptr;
+    s.error = nullptr;
+    return s;
+  }
+
+  // Переводит слот в pending и ждет, пока его не применит комбайнер — этот
+  // поток или чужой. Результат забирается до освобождения слота: потом его
+  // может занять другой поток
+  bool finish(slot& s) {
+    s.state_.store(state::pending, std::memory_order_release);
+    while (s.state_.load(std::memory_order_acquire) != state::done) {
+      std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+      if (lock.owns_lock()) {
+        combine();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    bool found = s.found;
+    std::exception_ptr error = std::move(s.error);
+    s.error = nullptr;
+    s.state_.store(state::free, std::memory_order_release);
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return found;
+  }
+
+  bool is_left(op o) const {
+    return o == op::insert || o == op::erase_left || o == op::find_left;
+  }
+
+  // Несколько проходов подряд: пока комбайнер применяет пачку, другие
+  // потоки успевают опубликовать следующие операции
+  void combine() {
+    for (std::size_t pass = 0; pass < combine_passes; pass++) {
+      if (!combine_pass()) {
+        return;
+      }
+    }
+  }
+
+  // Места в batch_ хватает на все слоты, поэтому сбор не выделяет память
+  void collect() {
+    batch_.clear();
+    for (slot& s : slots_) {
+      if (s.state_.load(std::memory_order_acquire) == state::pending) {
+        batch_.push_back(&s);
+      }
+    }
+  }
+
+  bool combine_pass() {
+    collect();
+    if (batch_.empty()) {
+      return false;
+    }
+    // Сначала операции по left в порядке left, затем по right. Порядок
+    // нужен только для кэша: если компаратор бросил посреди сортировки,
+    // пачка собирается заново и применяется как есть
+    try {
+      CompareLeft compare_left = bimap_.key_comp_left();
+      CompareRight compare_right = bimap_.key_comp_right();
+      std::sort(batch_.begin(), batch_.end(), [&](slot* a, slot* b) {
+        if (is_left(a->op_) != is_left(b->op_)) {
+          return is_left(a->op_);
+        }
+        return is_left(a->op_) ? compare_left(*a->left, *b->left)
+                               : compare_right(*a->right, *b->right);
+      });
+    } catch (...) {
+      collect();
+    }
+    for (slot* s : batch_) {
+      try {
+        apply(*s);
+      } catch (...) {
+        s->error = std::current_exception();
+      }
+      s->state_.store(state::done, std::memory_order_release);
+    }
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    combined_.fetch_add(batch_.size(), std::memory_order_relaxed);
+    return true;
+  }
+
+  void apply(slot& s) {
+    switch (s.op_) {
+    case op::insert:
+      s.found = bimap_.insert(*s.left, *s.right) != bimap_.end_left();
+      break;
+    case op::erase_left:
+      s.found = bimap_.erase_left(*s.left);
+      break;
+    case op::erase_right:
+      s.found = bimap_.erase_right(*s.right);
+      break;
+    case op::find_left: {
+      auto it = bimap_.find_left(*s.left);
+      if (it != bimap_.end_left()) {
+        s.right_out->emplace(it.get_value());
+      }
+      break;
+    }
+    case op::find_right: {
+      auto it = bimap_.find_right(*s.right);
+      if (it != bimap_.end_right()) {
+        s.left_out->emplace(it.get_value());
+      }
+      break;
+    }
+    }
+  }
+
+  bimap_t bimap_;
+  mutable std::mutex mutex_;
+  std::array<slot, slot_count> slots_;
+  // Буфер пачки, используется только комбайнером
+  std::vector<slot*> batch_;
+  std::atomic<std::size_t> batches_{0};
+  std::atomic<std::size_t> combined_{0};
+};
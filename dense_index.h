@@ -0,0 +1,136 @@
+#pragma once
+
+#include "radix_index.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace intrusive_map {
+// Плотный индекс целочисленной стороны: массив вершин, где ключ k лежит в
+// ячейке k - base. find становится O(1), упорядоченные запросы и обход идут
+// по дереву, которое и так хранит ключи по порядку. Начальный диапазон
+// [Lo, Hi) выделяется сразу, ключи вне него расширяют массив (в обе
+// стороны, с удвоением), но массив не становится длиннее
+// max(Hi - Lo, density * ключей в нем). Ключ, ради которого пришлось бы
+// превысить этот предел, в массив не попадает и ищется по дереву; пока
+// такие ключи есть, массив не растет, чтобы не накрыть их пустыми
+// ячейками. Ключи должны помещаться в long long, а эквивалентность
+// компаратора стороны — совпадать с равенством
+template <long long Lo = 0, long long Hi = 0>
+struct dense_index {};
+
+template <typename Tag, typename Key, typename Compare, long long Lo,
+          long long Hi>
+class side_index<Tag, Key, Compare, dense_index<Lo, Hi>> {
+  static_assert(std::is_integral_v<Key>, "dense_index requires integral keys");
+  static_assert(Lo <= Hi, "dense_index range is empty");
+
+public:
+  static constexpr bool enabled = true;
+  static constexpr bool ordered = false;
+  static constexpr std::uint64_t density = 4;
+
+  side_index() : slots_(static_cast<std::size_t>(Hi - Lo)) {}
+  side_index(side_index&& other) noexcept
+      : base_(other.base_), slots_(std::move(other.slots_)),
+        count_(std::exchange(other.count_, 0)),
+        spilled_(std::exchange(other.spilled_, 0)) {}
+
+  // Может выделить память под массив, при исключении индекс не меняется
+  void insert(Key const& key, base_node const* node) {
+    if (!reserve(key)) {
+      spilled_++;
+      return;
+    }
+    slots_[offset(key)] = node;
+    count_++;
+  }
+  // key должен быть в индексе
+  void erase(Key const& key) noexcept {
+    std::uint64_t i = offset(key);
+    if (i < slots_.size()) {
+      slots_[i] = nullptr;
+      count_--;
+    } else {
+      spilled_--;
+    }
+  }
+  void assign(Key const& key, base_node const* node) {
+    std::uint64_t i = offset(key);
+    if (i < slots_.size()) {
+      slots_[i] = node;
+    }
+  }
+  void swap(side_index& other) noexcept {
+    std::swap(base_, other.base_);
+    slots_.swap(other.slots_);
+    std::swap(count_, other.count_);
+    std::swap(spilled_, other.spilled_);
+  }
+
+  // false — key вне массива, его надо искать по дереву
+  bool covers(Key const& key) const {
+    return offset(key) < slots_.size();
+  }
+  base_node const* find(Key const& key) const {
+    std::uint64_t i = offset(key);
+    return i < slots_.size() ? slots_[i] : nullptr;
+  }
+
+private:
+  // Ключи меньше base_ дают огромное смещение и тоже оказываются вне массива
+  std::uint64_t offset(Key const& key) const {
+    return static_cast<std::uint64_t>(static_cast<long long>(key)) -
+           static_cast<std::uint64_t>(base_);
+  }
+
+  // Расширяет массив до key, false — key остается только в дереве
+  bool reserve(Key const& key) {
+    auto k = static_cast<long long>(key);
+    if (slots_.empty()) {
+      slots_.resize(1);
+      base_ = k;
+      return true;
+    }
+    if (covers(key)) {
+      return true;
+    }
+    if (spilled_ != 0) {
+      return false;
+    }
+    std::uint64_t limit = std::max<std::uint64_t>(
+        static_cast<std::uint64_t>(Hi - Lo), density * (count_ + 1));
+    std::uint64_t size = slots_.size();
+    if (size >= limit) {
+      return false;
+    }
+    if (k < base_) {
+      std::uint64_t need = static_cast<std::uint64_t>(base_) -
+                           static_cast<std::uint64_t>(k);
+      if (need > limit - size) {
+        return false;
+      }
+      std::uint64_t grow = std::min(std::max(need, size), limit - size);
+      slots_.insert(slots_.begin(), static_cast<std::size_t>(grow), nullptr);
+      base_ = static_cast<long long>(static_cast<std::uint64_t>(base_) - grow);
+    } else {
+      std::uint64_t need = offset(key) + 1;
+      if (need > limit) {
+        return false;
+      }
+      slots_.resize(static_cast<std::size_t>(
+          std::min(std::max(need, 2 * size), limit)));
+    }
+    return true;
+  }
+
+  long long base_{Lo};
+  std::vector<base_node const*> slots_;
+  // Ключей в массиве и ключей, оставшихся только в дереве
+  std::uint64_t count_{0};
+  std::uint64_t spilled_{0};
+};
+} // namespace intrusive_map
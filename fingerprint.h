@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace intrusive_map {
+// Отпечаток множества пар, не зависящий от порядка: сумма по модулю 2^64
+// хешей пар в двух дорожках. Хеш пары в каждой дорожке свой: обе
+// смешивают std::hash ключей со своими затравками, так что ни одна не
+// вычисляется из другой. Вставка прибавляет хеши пары, удаление вычитает,
+// поэтому отпечаток поддерживается за O(1) на мутацию. Разные отпечатки
+// гарантируют разные множества пар (при согласованных с равенством
+// std::hash), равные — совпадение с вероятностью около 2^-128, пока нет
+// коллизий самих 64-битных std::hash ключей: такая коллизия общая для
+// обеих дорожек
+struct content_fingerprint {
+  std::uint64_t sum{0};
+  std::uint64_t mixed{0};
+
+  friend bool operator==(content_fingerprint const&,
+                         content_fingerprint const&) = default;
+};
+
+// Финализатор splitmix64
+inline std::uint64_t mix64(std::uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+template <typename Left, typename Right>
+class fingerprint_tracker {
+public:
+  void add(Left const& left, Right const& right) {
+    std::uint64_t hl = std::hash<Left>()(left);
+    std::uint64_t hr = std::hash<Right>()(right);
+    value_.sum += pair_hash(hl, hr, sum_seeds);
+    value_.mixed += pair_hash(hl, hr, mixed_seeds);
+  }
+  void remove(Left const& left, Right const& right) {
+    std::uint64_t hl = std::hash<Left>()(left);
+    std::uint64_t hr = std::hash<Right>()(right);
+    value_.sum -= pair_hash(hl, hr, sum_seeds);
+    value_.mixed -= pair_hash(hl, hr, mixed_seeds);
+  }
+  void swap(fingerprint_tracker& other) noexcept {
+    std::swap(value_, other.value_);
+  }
+  void reset() {
+    value_ = content_fingerprint();
+  }
+  content_fingerprint const& value() const {
+    return value_;
+  }
+
+private:
+  // Затравки left и right для каждой дорожки
+  struct seeds {
+    std::uint64_t left;
+    std::uint64_t right;
+  };
+  static constexpr seeds sum_seeds{0, 0xc2b2ae3d27d4eb4fULL};
+  static constexpr seeds mixed_seeds{0x9e3779b97f4a7c15ULL,
+                                     0x165667b19e3779f9ULL};
+
+  // Несимметрична: пары (a, b) и (b, a) дают разные хеши
+  static std::uint64_t pair_hash(std::uint64_t hl, std::uint64_t hr,
+                                 seeds s) {
+    return mix64(mix64(hl ^ s.left) + mix64(hr ^ s.right));
+  }
+
+  content_fingerprint value_;
+};
+
+struct no_fingerprint {
+  template <typename Left, typename Right>
+  void add(Left const&, Right const&) {}
+  template <typename Left, typename Right>
+  void remove(Left const&, Right const&) {}
+  void swap(no_fingerprint&) noexcept {}
+  void reset() {}
+};
+} // namespace intrusive_map
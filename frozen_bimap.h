@@ -0,0 +1,313 @@
+#pragma once
+
+#include "bimap_node.h"
+#include "compare_traits.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace intrusive_map {
+// Одна сторона frozen_bimap: ключи в порядке Эйтцингера (BFS-порядок
+// идеально сбалансированного дерева поиска, корень — слот 1, дети слота
+// k — слоты 2k и 2k + 1). Слот 0 означает end
+template <typename Key, typename Compare>
+struct eytzinger_side : private Compare {
+  eytzinger_side(Compare compare) : Compare(std::move(compare)) {}
+
+  std::size_t size() const {
+    return keys_.size();
+  }
+  Key const& key(std::size_t k) const {
+    return keys_[k - 1];
+  }
+
+  // Спуск без ветвлений: на каждом уровне k = 2k + (keys[k] < x), в конце
+  // отбрасываются последние шаги вправо. Пока идет сравнение, следующие
+  // уровни уже подгружаются в кэш
+  std::size_t lower_bound(Key const& x) const {
+    std::size_t k = 1;
+    while (k <= size()) {
+      prefetch(4 * k);
+      k = 2 * k + static_cast<std::size_t>(less(key(k), x));
+    }
+    return k >> (std::countr_one(k) + 1);
+  }
+  std::size_t upper_bound(Key const& x) const {
+    std::size_t k = 1;
+    while (k <= size()) {
+      prefetch(4 * k);
+      k = 2 * k + static_cast<std::size_t>(!less(x, key(k)));
+    }
+    return k >> (std::countr_one(k) + 1);
+  }
+  std::size_t find(Key const& x) const {
+    std::size_t k = lower_bound(x);
+    return k != 0 && !less(x, key(k)) ? k : 0;
+  }
+
+  // Обход в порядке ключей по неявному дереву
+  std::size_t first() const {
+    std::size_t k = 1;
+    if (size() == 0) {
+      return 0;
+    }
+    while (2 * k <= size()) {
+      k = 2 * k;
+    }
+    return k;
+  }
+  std::size_t last() const {
+    std::size_t k = 1;
+    if (size() == 0) {
+      return 0;
+    }
+    while (2 * k + 1 <= size()) {
+      k = 2 * k + 1;
+    }
+    return k;
+  }
+  std::size_t next(std::size_t k) const {
+    if (2 * k + 1 <= size()) {
+      k = 2 * k + 1;
+      while (2 * k <= size()) {
+        k = 2 * k;
+      }
+      return k;
+    }
+    return k >> (std::countr_one(k) + 1);
+  }
+  std::size_t prev(std::size_t k) const {
+    if (k == 0) {
+      return last();
+    }
+    if (2 * k <= size()) {
+      k = 2 * k;
+      while (2 * k + 1 <= size()) {
+        k = 2 * k + 1;
+      }
+      return k;
+    }
+    return k >> (std::countr_zero(k) + 1);
+  }
+
+  // Спуску нужен только a < b: булев компаратор вызывается один раз
+  // напрямую, а не через compare_keys, который при a >= b зовет его дважды
+  bool less(Key const& a, Key const& b) const {
+    Compare const& c = *this;
+    if constexpr (std::is_convertible_v<decltype(c(a, b)), bool>) {
+      return c(a, b);
+    } else {
+      return three_way_compare(c, a, b) < 0;
+    }
+  }
+
+#if defined(__GNUC__)
+  static constexpr bool prefetch_keys = true;
+#else
+  static constexpr bool prefetch_keys = false;
+#endif
+
+  // Подсказка кэшу без проверки границ: prefetch не обращается к памяти,
+  // поэтому адрес за концом массива безопасен, а в цикле нет ветвления.
+  // Адрес считается через uintptr_t, чтобы не выходить указателем за массив
+  void prefetch([[maybe_unused]] std::size_t k) const {
+    if constexpr (prefetch_keys) {
+      auto base = reinterpret_cast<std::uintptr_t>(keys_.data());
+      __builtin_prefetch(
+          reinterpret_cast<void const*>(base + (k - 1) * sizeof(Key)));
+    }
+  }
+
+  std::vector<Key> keys_;
+  // cross_[k - 1] — слот пары слота k на противоположной стороне
+  std::vector<std::size_t> cross_;
+};
+
+// Раскладка рангов 0..n-1 по слотам Эйтцингера 1..n
+inline void eytzinger_layout(std::vector<std::size_t>& slot_of_rank,
+                             std::size_t k, std::size_t& rank) {
+  if (k >= slot_of_rank.size() + 1) {
+    return;
+  }
+  eytzinger_layout(slot_of_rank, 2 * k, rank);
+  slot_of_rank[rank++] = k;
+  eytzinger_layout(slot_of_rank, 2 * k + 1, rank);
+}
+} // namespace intrusive_map
+
+// Неизменяемый снимок bimap, оптимизированный под чтение: обе стороны
+// лежат в непрерывных массивах в порядке Эйтцингера со ссылками на слот
+// пары на другой стороне. Получается через bimap::freeze()
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+class frozen_bimap {
+  using left_side = intrusive_map::eytzinger_side<Left, CompareLeft>;
+  using right_side = intrusive_map::eytzinger_side<Right, CompareRight>;
+
+public:
+  template <typename Tag>
+  class iterator_impl {
+    using opposite_tag = typename intrusive_map::opportunity_tag<Tag>::type;
+
+  public:
+    using key_t = typename intrusive_map::map_key<Left, Right, Tag>::key_t;
+    using val_t = typename intrusive_map::map_value<Left, Right, Tag>::val_t;
+
+    iterator_impl() = default;
+
+    key_t const& operator*() const {
+      return owner_->template side<Tag>().key(k_);
+    }
+    key_t const* operator->() const {
+      return &**this;
+    }
+    val_t const& get_value() const {
+      return *flip();
+    }
+
+    iterator_impl& operator++() {
+      k_ = owner_->template side<Tag>().next(k_);
+      return *this;
+    }
+    iterator_impl operator++(int) {
+      iterator_impl ret = *this;
+      ++*this;
+      return ret;
+    }
+    iterator_impl& operator--() {
+      k_ = owner_->template side<Tag>().prev(k_);
+      return *this;
+    }
+    iterator_impl operator--(int) {
+      iterator_impl ret = *this;
+      --*this;
+      return ret;
+    }
+
+    friend bool operator==(iterator_impl const& a, iterator_impl const& b) {
+      return a.k_ == b.k_;
+    }
+    friend bool operator!=(iterator_impl const& a, iterator_impl const& b) {
+      return a.k_ != b.k_;
+    }
+
+    iterator_impl<opposite_tag> flip() const {
+      return iterator_impl<opposite_tag>(
+          owner_, k_ == 0 ? 0 : owner_->template side<Tag>().cross_[k_ - 1]);
+    }
+
+  private:
+    friend class frozen_bimap;
+
+    iterator_impl(frozen_bimap const* owner, std::size_t k)
+        : owner_(owner), k_(k) {}
+
+    frozen_bimap const* owner_{nullptr};
+    std::size_t k_{0};
+  };
+
+  using left_iterator = iterator_impl<intrusive_map::left_tag>;
+  using right_iterator = iterator_impl<intrusive_map::right_tag>;
+
+  // lefts и rights отсортированы по своим компараторам,
+  // right_rank[i] — позиция в rights пары для lefts[i]
+  frozen_bimap(std::vector<Left> const& lefts, std::vector<Right> const& rights,
+               std::vector<std::size_t> const& right_rank,
+               CompareLeft compare_left = CompareLeft(),
+               CompareRight compare_right = CompareRight())
+      : left_(std::move(compare_left)), right_(std::move(compare_right)) {
+    std::size_t n = lefts.size();
+    std::vector<std::size_t> slot_of_rank(n);
+    std::size_t rank = 0;
+    intrusive_map::eytzinger_layout(slot_of_rank, 1, rank);
+    std::vector<std::size_t> rank_of_slot(n + 1);
+    for (std::size_t r = 0; r < n; r++) {
+      rank_of_slot[slot_of_rank[r]] = r;
+    }
+    left_.keys_.reserve(n);
+    right_.keys_.reserve(n);
+    left_.cross_.resize(n);
+    right_.cross_.resize(n);
+    for (std::size_t k = 1; k <= n; k++) {
+      left_.keys_.push_back(lefts[rank_of_slot[k]]);
+      right_.keys_.push_back(rights[rank_of_slot[k]]);
+    }
+    for (std::size_t r = 0; r < n; r++) {
+      std::size_t left_slot = slot_of_rank[r];
+      std::size_t right_slot = slot_of_rank[right_rank[r]];
+      left_.cross_[left_slot - 1] = right_slot;
+      right_.cross_[right_slot - 1] = left_slot;
+    }
+  }
+
+  left_iterator find_left(Left const& left) const {
+    return {this, left_.find(left)};
+  }
+  right_iterator find_right(Right const& right) const {
+    return {this, right_.find(right)};
+  }
+
+  Right const& at_left(Left const& key) const {
+    left_iterator it = find_left(key);
+    if (it == end_left()) {
+      throw std::out_of_range("invalid key");
+    }
+    return it.get_value();
+  }
+  Left const& at_right(Right const& key) const {
+    right_iterator it = find_right(key);
+    if (it == end_right()) {
+      throw std::out_of_range("invalid key");
+    }
+    return it.get_value();
+  }
+
+  left_iterator lower_bound_left(Left const& left) const {
+    return {this, left_.lower_bound(left)};
+  }
+  left_iterator upper_bound_left(Left const& left) const {
+    return {this, left_.upper_bound(left)};
+  }
+  right_iterator lower_bound_right(Right const& right) const {
+    return {this, right_.lower_bound(right)};
+  }
+  right_iterator upper_bound_right(Right const& right) const {
+    return {this, right_.upper_bound(right)};
+  }
+
+  left_iterator begin_left() const {
+    return {this, left_.first()};
+  }
+  left_iterator end_left() const {
+    return {this, 0};
+  }
+  right_iterator begin_right() const {
+    return {this, right_.first()};
+  }
+  right_iterator end_right() const {
+    return {this, 0};
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+  std::size_t size() const {
+    return left_.size();
+  }
+
+private:
+  template <typename Tag>
+  auto const& side() const {
+    if constexpr (std::is_same_v<Tag, intrusive_map::left_tag>) {
+      return left_;
+    } else {
+      return right_;
+    }
+  }
+
+  left_side left_;
+  right_side right_;
+};
@@ -1,10 +1,12 @@
 #pragma once
 
 #include "bimap_node.h"
+#include "bimap_stats.h"
+#include "compare_traits.h"
 #include <functional>
 #include <iostream>
 
-template <typename L, typename R, typename C1, typename C2>
+template <typename L, typename R, typename C1, typename C2, typename P>
 struct bimap;
 
 namespace intrusive_map {
@@ -18,12 +20,19 @@ struct map_iterator;
 // bimap_node и удалять его соответственно, и делать вызовы методов этой map.
 // В целом, я не хочу чтобы ей можно было пользоваться без какой-либо обертки.
 template <typename Left, typename Right, typename Tag = left_tag,
-          typename Compare = std::less<Left>>
+          typename Compare = std::less<Left>, typename Stats = no_stats,
+          typename Node = policy_bimap_node<Left, Right>>
 class intrusive_map : private Compare {
   using key_t = typename map_key<Left, Right, Tag>::key_t;
   using val_t = typename map_value<Left, Right, Tag>::val_t;
-
-  template <typename L, typename R, typename C1, typename C2>
+  // Префикс ключа из вершины, см. key_prefix.h
+  using prefix_t = typename Node::template prefix_slot_t<Tag>;
+  static constexpr bool has_prefix = Node::template has_prefix<Tag>;
+  // Моноид аугментации, см. augment.h
+  using augment_t = typename Node::template augment_t<Tag>;
+  static constexpr bool has_augment = Node::template has_augment<Tag>;
+
+  template <typename L, typename R, typename C1, typename C2, typename P>
   friend struct ::bimap;
 
 public:
@@ -47,7 +56,7 @@ public:
     root_.insert_left(ptr);
   }
 
-  iterator insert(bimap_node<Left, Right>& val) {
+  iterator insert(Node& val) {
     return iterator(insert_impl(find_impl(val.template get_key<Tag>()), val));
   }
 
@@ -64,6 +73,18 @@ public:
     }
   }
 
+  // Поиск от пальца finger: поднимается до ближайшего предка, в поддерево
+  // которого попадает val, и спускается от него. Для ключей, близких к
+  // finger, путь короче, чем от корня
+  iterator find_from(iterator finger, key_t const& val) const {
+    iterator it = iterator(find_impl_from(finger.ptr_, val));
+    if (cmp(it, val) == 0) {
+      return it;
+    } else {
+      return end();
+    }
+  }
+
   iterator begin() const {
     iterator it = end();
     while (it.ptr_->left_) {
@@ -76,6 +97,16 @@ public:
     return intrusive_map::iterator(&root_);
   }
 
+  Compare const& key_comp() const {
+    return *this;
+  }
+
+  // Связывает пустое дерево из вершин, отсортированных по ключу без
+  // повторов, в идеально сбалансированное за O(n)
+  void link_sorted(Node* const* nodes, std::size_t n) {
+    root_.insert_left(link_balanced(nodes, 0, n));
+  }
+
   iterator lower_bound(key_t const& val) const {
     iterator it = iterator(find_impl(val));
     if (cmp(it, val) == -1) {
@@ -92,17 +123,142 @@ public:
     return it;
   }
 
+  // Агрегат augment_t по значениям пар, ключи которых лежат в [lo, hi).
+  // Спускается до вершины, где расходятся пути к lo и hi, и дальше по двум
+  // границам собирает готовые агрегаты поддеревьев — O(высоты)
+  auto aggregate(key_t const& lo, key_t const& hi) const
+    requires has_augment
+  {
+    base_node const* split = root_.left_;
+    while (split) {
+      if (cmp(split, lo) < 0) {
+        split = split->right_;
+      } else if (cmp(split, hi) >= 0) {
+        split = split->left_;
+      } else {
+        break;
+      }
+    }
+    if (split == nullptr) {
+      return augment_t::identity();
+    }
+    auto left_part = augment_t::identity();
+    for (base_node const* it = split->left_; it;) {
+      if (cmp(it, lo) >= 0) {
+        left_part = augment_t::combine(
+            augment_t::combine(lift(it), subtree_aggregate(it->right_)),
+            left_part);
+        it = it->left_;
+      } else {
+        it = it->right_;
+      }
+    }
+    auto right_part = augment_t::identity();
+    for (base_node const* it = split->right_; it;) {
+      if (cmp(it, hi) < 0) {
+        right_part = augment_t::combine(
+            right_part,
+            augment_t::combine(subtree_aggregate(it->left_), lift(it)));
+        it = it->right_;
+      } else {
+        it = it->left_;
+      }
+    }
+    return augment_t::combine(augment_t::combine(left_part, lift(split)),
+                              right_part);
+  }
+
+  // Обходит дерево без рекурсии и стека, спускаясь по left_/right_ и
+  // поднимаясь по parent_, глубина поддерживается по ходу движения
+  tree_shape shape() const {
+    tree_shape res;
+    base_node const* top = root_.left_;
+    if (top == nullptr) {
+      return res;
+    }
+    base_node const* it = top;
+    std::size_t depth = 0;
+    while (true) {
+      if (res.levels.size() <= depth) {
+        res.levels.push_back(0);
+      }
+      res.levels[depth]++;
+      res.size++;
+      res.total_depth += depth;
+      if (it->left_ || it->right_) {
+        it = it->left_ ? it->left_ : it->right_;
+        depth++;
+        continue;
+      }
+      while (it != top && (it->is_right() || it->parent_->right_ == nullptr)) {
+        it = it->parent_;
+        depth--;
+      }
+      if (it == top) {
+        break;
+      }
+      it = it->parent_->right_;
+    }
+    res.height = res.levels.size();
+    return res;
+  }
+
 private:
   // можно не хранить ссылку на root_, а передавать его в методах,
   // но это выглядит очень неприятно
   base_node& root_;
+  [[no_unique_address]] mutable Stats stats_;
   // Возвращает указатель на элемент, ключ которого скорее всего равен, т.е
   // или его left_ == nullptr и *it > val, или right_ == nullptr и *it < val,
   // или *it == val, сравнения выполняются в терминах функции cmp
   base_node* find_impl(key_t const& val) const {
-    base_node* it = const_cast<base_node*>(&root_);
+    return descend(const_cast<base_node*>(&root_), val, 0);
+  }
+
+  // То же, что find_impl, но начиная с вершины from
+  base_node* find_impl_from(base_node const* from, key_t const& val) const {
+    base_node* top = const_cast<base_node*>(from);
+    if (top == &root_) {
+      return find_impl(val);
+    }
+    int from_cmp = cmp(top, val);
+    if (from_cmp == 0) {
+      stats_.on_search(1);
+      return top;
+    }
+    // Поднимаемся, пока val лежит за границей поддерева top: границей
+    // служит первый предок, из которого путь к top уходит в сторону val
+    std::size_t depth = 1;
     while (true) {
-      int cmp_val = cmp(it, val);
+      while (top->parent_ != &root_ &&
+             (from_cmp < 0 ? top->is_right() : top->is_left())) {
+        top = top->parent_;
+        depth++;
+      }
+      base_node* bound = top->parent_;
+      if (bound == &root_) {
+        break;
+      }
+      int bound_cmp = cmp(bound, val);
+      depth++;
+      if (bound_cmp == 0) {
+        stats_.on_search(depth);
+        return bound;
+      }
+      if ((from_cmp < 0) == (bound_cmp > 0)) {
+        break;
+      }
+      top = bound;
+    }
+    return descend(top, val, depth - 1);
+  }
+
+  // Спуск от it, depth — длина уже пройденного пути для статистики
+  base_node* descend(base_node* it, key_t const& val, std::size_t depth) const {
+    prefix_t prefix = make_prefix(val);
+    while (true) {
+      depth++;
+      int cmp_val = cmp(it, val, prefix);
       if (cmp_val == 1) {
         if (it->left_ == nullptr) {
           break;
@@ -117,23 +273,83 @@ private:
         it = it->right_;
       }
     }
+    stats_.on_search(depth);
     return it;
   }
 
-  // Удаляет элемент по указателю
+  // Глубина рекурсии — высота сбалансированного дерева, O(log n)
+  base_node* link_balanced(Node* const* nodes, std::size_t lo,
+                           std::size_t hi) {
+    if (lo == hi) {
+      return nullptr;
+    }
+    std::size_t mid = lo + (hi - lo) / 2;
+    base_node* node = downcast<Left, Right, Tag>(nodes[mid]);
+    node->insert_left(link_balanced(nodes, lo, mid));
+    node->insert_right(link_balanced(nodes, mid + 1, hi));
+    if constexpr (has_augment) {
+      refresh_aggregate(node);
+    }
+    return node;
+  }
+
+  Node const* node_of(base_node const* p) const {
+    return static_cast<Node const*>(upcast<Left, Right, Tag>(p));
+  }
+  Node* node_of(base_node* p) const {
+    return static_cast<Node*>(upcast<Left, Right, Tag>(p));
+  }
+
+  auto lift(base_node const* p) const
+    requires has_augment
+  {
+    return augment_t::lift(node_of(p)->template get_value<Tag>());
+  }
+  auto subtree_aggregate(base_node const* p) const
+    requires has_augment
+  {
+    return p ? node_of(p)->template aggregate<Tag>() : augment_t::identity();
+  }
+  void refresh_aggregate(base_node* p)
+    requires has_augment
+  {
+    node_of(p)->template aggregate<Tag>() = augment_t::combine(
+        augment_t::combine(subtree_aggregate(p->left_), lift(p)),
+        subtree_aggregate(p->right_));
+  }
+  // Пересчитывает агрегаты на пути от p до корня, вызывается после любого
+  // изменения поддерева p или значения в самой p
+  void refresh_up(base_node* p) {
+    if constexpr (has_augment) {
+      for (; p != &root_; p = p->parent_) {
+        refresh_aggregate(p);
+      }
+    }
+  }
+
+  // Удаляет элемент по указателю, одна перестройка на удаление
   base_node* erase_impl(base_node const* it) {
+    stats_.on_restructure();
+    return splice_out(it);
+  }
+
+  base_node* splice_out(base_node const* it) {
     base_node* ret = it->next();
     if (it->left_ == nullptr && it->right_ == nullptr) {
       it->relink_parent(nullptr);
+      refresh_up(it->parent_);
     } else if (it->left_ == nullptr) {
       it->relink_parent(it->right_);
+      refresh_up(it->parent_);
     } else if (it->right_ == nullptr) {
       it->relink_parent(it->left_);
+      refresh_up(it->parent_);
     } else {
-      erase_impl(ret);
+      splice_out(ret);
       it->relink_parent(ret);
       ret->insert_left(it->left_);
       ret->insert_right(it->right_);
+      refresh_up(ret);
     }
     return ret;
   }
@@ -148,23 +364,57 @@ private:
     key_t const& key_a = upcast<Left, Right, Tag>(a)->template get_key<Tag>();
     return cmp(key_a, key_b);
   }
+  // Сначала сравнивает префиксы, лежащие в вершине, и только при их
+  // равенстве обращается к самому ключу
+  int cmp(base_node const* a, key_t const& key_b,
+          prefix_t const& prefix_b) const {
+    if constexpr (has_prefix) {
+      if (a != &root_) {
+        auto const& prefix_a =
+            static_cast<Node const*>(upcast<Left, Right, Tag>(a))
+                ->template prefix<Tag>();
+        if (prefix_a != prefix_b.prefix_) {
+          return prefix_a < prefix_b.prefix_ ? -1 : 1;
+        }
+      }
+    }
+    return cmp(a, key_b);
+  }
+  static prefix_t make_prefix(key_t const& key) {
+    prefix_t res;
+    if constexpr (has_prefix) {
+      res.prefix_ = typename Node::template prefix_extractor_t<Tag>()(key);
+    }
+    return res;
+  }
   // returns -1 key_a < key_b; 0 key_a == key_b; 1 key_a > key_b
   // root_->key == +inf
+  // Для трехсторонних компараторов (см. compare_traits.h) — один вызов
   int cmp(key_t const& key_a, key_t const& key_b) const {
-    if (this->operator()(key_a, key_b)) {
-      return -1;
-    }
-    if (this->operator()(key_b, key_a)) {
-      return 1;
+    stats_.on_compare();
+    if constexpr (is_three_way_v<Compare, key_t>) {
+      return three_way_compare(static_cast<Compare const&>(*this), key_a,
+                               key_b);
+    } else {
+      if (this->operator()(key_a, key_b)) {
+        return -1;
+      }
+      stats_.on_compare();
+      if (this->operator()(key_b, key_a)) {
+        return 1;
+      }
+      return 0;
     }
-    return 0;
   }
 
   // Делает вставку по указателю,
   // можно использовать только если it был получен из find_impl
   // с тем же val.get_key(), т. к. может сломать инвариант
-  base_node* insert_impl(base_node* it, bimap_node<Left, Right>& val) {
+  base_node* insert_impl(base_node* it, Node& val) {
     int cmp_val = cmp(it, val.template get_key<Tag>());
+    if (cmp_val != 0) {
+      stats_.on_restructure();
+    }
     if (cmp_val == 1) {
       it->insert_left(downcast<Left, Right, Tag>(&val));
       it = it->left_;
@@ -174,6 +424,28 @@ private:
       it->insert_right(downcast<Left, Right, Tag>(&val));
       it = it->right_;
     }
+    if (cmp_val != 0) {
+      refresh_up(it);
+    }
+    return it;
+  }
+
+  // Вставка без сравнений, когда следующий по порядку элемент уже известен
+  // (например, из индекса стороны): val встает сразу перед next, next ==
+  // &root_ — в конец
+  base_node* insert_before(base_node* next, Node& val) {
+    base_node* it = downcast<Left, Right, Tag>(&val);
+    stats_.on_restructure();
+    if (next->left_ == nullptr) {
+      next->insert_left(it);
+    } else {
+      base_node* prev = next->left_;
+      while (prev->right_ != nullptr) {
+        prev = prev->right_;
+      }
+      prev->insert_right(it);
+    }
+    refresh_up(it);
     return it;
   }
 };
@@ -183,10 +455,11 @@ struct map_iterator {
   using key_t = typename map_key<Left, Right, Tag>::key_t;
   using val_t = typename map_value<Left, Right, Tag>::val_t;
 
-  template <typename L, typename R, typename T, typename C>
+  template <typename L, typename R, typename T, typename C, typename S,
+            typename N>
   friend class intrusive_map;
 
-  template <typename L, typename R, typename C1, typename C2>
+  template <typename L, typename R, typename C1, typename C2, typename P>
   friend struct ::bimap;
 
   friend struct map_iterator<Left, Right, typename opportunity_tag<Tag>::type>;
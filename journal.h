@@ -0,0 +1,173 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace intrusive_map {
+// Журнал изменений bimap (Policy::journal): каждая успешная мутация пишется
+// одной двоичной записью в пользовательский sink, а replay применяет
+// записи к другой bimap. Запись — байт операции и ключи в journal_codec.
+// clear пишется отдельной записью, а swap и присваивание, меняющие
+// содержимое целиком, — записью clear и вставками всех новых пар. sink
+// привязан к объекту: swap, присваивание и перемещение его не переносят,
+// а новая bimap (копия или перемещенная) создается без sink
+enum class journal_op : unsigned char {
+  insert = 1,        // left, right
+  erase = 2,         // left
+  replace_left = 3,  // right, новый left
+  replace_right = 4, // left, новый right
+  clear = 5          // без ключей
+};
+
+// Кодирование ключей в журнале. Для своих типов достаточно
+// специализировать encode / decode
+template <typename T>
+struct journal_codec;
+
+// varint, знаковые — через zigzag
+template <std::integral T>
+struct journal_codec<T> {
+  static void encode(T value, std::string& out) {
+    std::uint64_t u = 0;
+    if constexpr (std::is_signed_v<T>) {
+      auto v = static_cast<std::int64_t>(value);
+      u = (static_cast<std::uint64_t>(v) << 1) ^
+          (v < 0 ? ~std::uint64_t(0) : 0);
+    } else {
+      u = value;
+    }
+    while (u >= 0x80) {
+      out.push_back(static_cast<char>(u | 0x80));
+      u >>= 7;
+    }
+    out.push_back(static_cast<char>(u));
+  }
+  static T decode(std::string_view& in) {
+    std::uint64_t u = 0;
+    for (int shift = 0;; shift += 7) {
+      if (in.empty() || shift >= 64) {
+        throw std::invalid_argument("truncated journal record");
+      }
+      auto b = static_cast<unsigned char>(in.front());
+      in.remove_prefix(1);
+      u |= std::uint64_t(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        break;
+      }
+    }
+    if constexpr (std::is_signed_v<T>) {
+      u = (u >> 1) ^ (~(u & 1) + 1);
+    }
+    return static_cast<T>(u);
+  }
+};
+
+template <>
+struct journal_codec<std::string> {
+  static void encode(std::string const& value, std::string& out) {
+    journal_codec<std::size_t>::encode(value.size(), out);
+    out.append(value);
+  }
+  static std::string decode(std::string_view& in) {
+    std::size_t size = journal_codec<std::size_t>::decode(in);
+    if (in.size() < size) {
+      throw std::invalid_argument("truncated journal record");
+    }
+    std::string res(in.substr(0, size));
+    in.remove_prefix(size);
+    return res;
+  }
+};
+
+// Пишет записи в sink; буфер записи переиспользуется между вызовами
+class journal_sink {
+public:
+  using sink_t = std::function<void(std::string_view)>;
+
+  void set(sink_t sink) {
+    sink_ = std::move(sink);
+  }
+  bool enabled() const {
+    return static_cast<bool>(sink_);
+  }
+
+  template <typename... Keys>
+  void record(journal_op op, Keys const&... keys) {
+    if (!sink_) {
+      return;
+    }
+    buffer_.clear();
+    buffer_.push_back(static_cast<char>(op));
+    (journal_codec<Keys>::encode(keys, buffer_), ...);
+    sink_(buffer_);
+  }
+
+private:
+  sink_t sink_;
+  std::string buffer_;
+};
+
+struct no_journal {
+  template <typename... Keys>
+  void record(journal_op, Keys const&...) {}
+  static constexpr bool enabled() {
+    return false;
+  }
+};
+
+// Применяет к b записи журнала, записанные подряд. Возвращает число
+// примененных записей, на испорченной записи бросает std::invalid_argument
+// (уже примененные записи остаются)
+template <typename Bimap>
+std::size_t replay(Bimap& b, std::string_view journal) {
+  using left_t = std::remove_cvref_t<decltype(*b.begin_left())>;
+  using right_t = std::remove_cvref_t<decltype(*b.begin_right())>;
+  std::size_t applied = 0;
+  while (!journal.empty()) {
+    auto op = static_cast<journal_op>(journal.front());
+    journal.remove_prefix(1);
+    switch (op) {
+    case journal_op::insert: {
+      left_t left = journal_codec<left_t>::decode(journal);
+      right_t right = journal_codec<right_t>::decode(journal);
+      b.insert(std::move(left), std::move(right));
+      break;
+    }
+    case journal_op::erase:
+      b.erase_left(journal_codec<left_t>::decode(journal));
+      break;
+    case journal_op::replace_left: {
+      right_t right = journal_codec<right_t>::decode(journal);
+      left_t left = journal_codec<left_t>::decode(journal);
+      auto it = b.find_right(right);
+      if (it != b.end_right()) {
+        b.replace_left(it, std::move(left));
+      }
+      break;
+    }
+    case journal_op::replace_right: {
+      left_t left = journal_codec<left_t>::decode(journal);
+      right_t right = journal_codec<right_t>::decode(journal);
+      auto it = b.find_left(left);
+      if (it != b.end_left()) {
+        b.replace_right(it, std::move(right));
+      }
+      break;
+    }
+    case journal_op::clear:
+      b.clear();
+      break;
+    default:
+      throw std::invalid_argument("unknown journal record");
+    }
+    applied++;
+  }
+  return applied;
+}
+} // namespace intrusive_map
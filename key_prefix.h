@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+namespace intrusive_map {
+// Префикс ключа — короткое значение, хранимое в вершине рядом со ссылками
+// дерева. Экстрактор префикса должен быть default constructible и сохранять
+// порядок компаратора: если a < b, то prefix(a) <= prefix(b), а у
+// эквивалентных ключей префиксы равны. Тогда при разных префиксах исход
+// сравнения известен без обращения к самим ключам.
+
+// Префиксы не хранятся, ключи всегда сравниваются целиком
+struct no_prefix {};
+
+// Первые 8 байт строки big-endian: подходит для std::less над std::string и
+// другими строками, сравниваемыми лексикографически по unsigned char
+struct string_prefix {
+  std::uint64_t operator()(std::string_view s) const noexcept {
+    std::uint64_t res = 0;
+    std::size_t n = std::min<std::size_t>(s.size(), 8);
+    for (std::size_t i = 0; i < 8; i++) {
+      res <<= 8;
+      if (i < n) {
+        res |= static_cast<unsigned char>(s[i]);
+      }
+    }
+    return res;
+  }
+};
+
+template <typename Tag, typename Key, typename Prefix>
+struct prefix_slot {
+  using prefix_t = std::invoke_result_t<Prefix const&, Key const&>;
+  prefix_t prefix_{};
+};
+
+template <typename Tag, typename Key>
+struct prefix_slot<Tag, Key, no_prefix> {};
+} // namespace intrusive_map
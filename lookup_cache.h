@@ -0,0 +1,59 @@
+#pragma once
+
+#include "bimap_node.h"
+#include <array>
+#include <cstddef>
+#include <functional>
+
+namespace intrusive_map {
+struct cache_counters {
+  std::size_t hits{0};
+  std::size_t misses{0};
+};
+
+// Кэш прямого отображения hash(key) -> вершина перед поиском по дереву одной
+// стороны. Слот проверяется одним сравнением ключа, поэтому устаревший
+// указатель недопустим: вершина выбрасывается из кэша до удаления и до смены
+// ключа, а при переезде вершин (move, swap) кэш очищается целиком.
+// Tag различает пустые кэши сторон, чтобы оба сжимались [[no_unique_address]]
+template <typename Tag, typename Key, std::size_t N,
+          typename Hash = std::hash<Key>>
+class lookup_cache {
+public:
+  base_node const*& slot(Key const& key) {
+    return slots_[Hash()(key) % N];
+  }
+
+  void forget(Key const& key, base_node const* node) {
+    base_node const*& s = slot(key);
+    if (s == node) {
+      s = nullptr;
+    }
+  }
+
+  void clear() {
+    slots_.fill(nullptr);
+  }
+
+  void hit() {
+    counters_.hits++;
+  }
+  void miss() {
+    counters_.misses++;
+  }
+  cache_counters const& counters() const {
+    return counters_;
+  }
+
+private:
+  std::array<base_node const*, N> slots_{};
+  cache_counters counters_;
+};
+
+template <typename Tag, typename Key, typename Hash>
+class lookup_cache<Tag, Key, 0, Hash> {
+public:
+  void forget(Key const&, base_node const*) {}
+  void clear() {}
+};
+} // namespace intrusive_map
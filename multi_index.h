@@ -0,0 +1,498 @@
+#pragma once
+
+#include "bimap_node.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace intrusive_map {
+// Индекс multi_index: Tag различает map_node в вершине, Key — указатель на
+// член или функция, которая через std::invoke достает ключ из записи.
+// В неуникальном индексе равные ключи идут в порядке вставки
+template <typename Tag, auto Key, typename Compare = std::less<>,
+          bool Unique = true>
+struct index_by {
+  using tag = Tag;
+  using compare = Compare;
+  static constexpr bool unique = Unique;
+
+  template <typename Record>
+  static decltype(auto) key(Record const& record) {
+    return std::invoke(Key, record);
+  }
+};
+
+template <typename Tag, auto Key, typename Compare = std::less<>>
+using non_unique_index_by = index_by<Tag, Key, Compare, false>;
+
+// Запись и по звену map_node на каждый индекс — одна аллокация на запись,
+// как bimap_node для двух сторон
+template <typename Record, typename... Tags>
+struct multi_index_node : map_node<Tags>... {
+  template <typename... Args>
+  explicit multi_index_node(Args&&... args)
+      : value_(std::forward<Args>(args)...) {}
+
+  Record value_;
+};
+
+// Корни деревьев всех индексов, как empty_bimap_node у bimap
+template <typename... Tags>
+struct multi_index_roots : map_node<Tags>... {};
+
+template <typename Node, typename Tag>
+struct multi_index_iterator {
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type =
+      std::remove_cvref_t<decltype(std::declval<Node>().value_)>;
+  using difference_type = std::ptrdiff_t;
+  using pointer = value_type const*;
+  using reference = value_type const&;
+
+  multi_index_iterator() = default;
+  explicit multi_index_iterator(base_node const* ptr) : ptr_(ptr) {}
+
+  reference operator*() const {
+    return node()->value_;
+  }
+  pointer operator->() const {
+    return &node()->value_;
+  }
+
+  multi_index_iterator& operator++() {
+    ptr_ = ptr_->next();
+    return *this;
+  }
+  multi_index_iterator operator++(int) {
+    multi_index_iterator res = *this;
+    ++*this;
+    return res;
+  }
+  multi_index_iterator& operator--() {
+    ptr_ = ptr_->prev();
+    return *this;
+  }
+  multi_index_iterator operator--(int) {
+    multi_index_iterator res = *this;
+    --*this;
+    return res;
+  }
+
+  friend bool operator==(multi_index_iterator const&,
+                         multi_index_iterator const&) = default;
+
+  Node const* node() const {
+    return static_cast<Node const*>(static_cast<map_node<Tag> const*>(ptr_));
+  }
+
+  base_node const* ptr_{nullptr};
+};
+} // namespace intrusive_map
+
+// Контейнер записей с несколькими индексами, обобщение bimap на N сторон:
+// вершина наследует map_node<Tag> на каждый индекс, поэтому запись лежит в
+// одной аллокации, а insert / erase держат все деревья согласованными.
+// Деревья, как и в bimap, — несбалансированные деревья поиска.
+//   struct by_id {};
+//   struct by_name {};
+//   multi_index<person, intrusive_map::index_by<by_id, &person::id>,
+//               intrusive_map::index_by<by_name, &person::name>>
+//       people;
+//   people.find<by_name>("alice");
+template <typename Record, typename... Indices>
+class multi_index {
+  static_assert(sizeof...(Indices) > 0, "multi_index needs an index");
+
+  using node_t =
+      intrusive_map::multi_index_node<Record, typename Indices::tag...>;
+  using roots_t = intrusive_map::multi_index_roots<typename Indices::tag...>;
+  using base_node = intrusive_map::base_node;
+
+  template <typename Tag>
+  static constexpr std::size_t position() {
+    constexpr std::array<bool, sizeof...(Indices)> same{
+        std::is_same_v<Tag, typename Indices::tag>...};
+    std::size_t i = 0;
+    while (i < same.size() && !same[i]) {
+      i++;
+    }
+    return i;
+  }
+
+  template <typename Tag>
+  using index_t =
+      std::tuple_element_t<position<Tag>(), std::tuple<Indices...>>;
+
+public:
+  using value_type = Record;
+  using first_tag =
+      typename std::tuple_element_t<0, std::tuple<Indices...>>::tag;
+  template <typename Tag>
+  using iterator = intrusive_map::multi_index_iterator<node_t, Tag>;
+
+  multi_index() = default;
+  explicit multi_index(typename Indices::compare... compares)
+      : compares_(std::move(compares)...) {}
+
+  // Копия связывает каждое дерево сбалансированным в порядке other, так
+  // что порядок равных ключей в неуникальных индексах сохраняется
+  multi_index(multi_index const& other) : compares_(other.compares_) {
+    std::vector<std::pair<node_t const*, node_t*>> copies;
+    copies.reserve(other.size_);
+    try {
+      for (auto it = other.begin<first_tag>(); it != other.end<first_tag>();
+           ++it) {
+        copies.emplace_back(it.node(), nullptr);
+        copies.back().second = new node_t(*it);
+      }
+    } catch (...) {
+      for (auto const& copy : copies) {
+        delete copy.second;
+      }
+      throw;
+    }
+    std::sort(copies.begin(), copies.end(),
+              [](auto const& a, auto const& b) {
+                return std::less<>()(a.first, b.first);
+              });
+    (link_copy<typename Indices::tag>(other, copies), ...);
+    size_ = other.size_;
+  }
+  multi_index(multi_index&& other) noexcept
+      : compares_(std::move(other.compares_)) {
+    swap_trees(other);
+  }
+
+  multi_index& operator=(multi_index const& other) {
+    if (this != &other) {
+      multi_index tmp(other);
+      swap(tmp);
+    }
+    return *this;
+  }
+  multi_index& operator=(multi_index&& other) noexcept {
+    if (this != &other) {
+      multi_index tmp(std::move(other));
+      swap(tmp);
+    }
+    return *this;
+  }
+
+  ~multi_index() {
+    clear();
+  }
+
+  void swap(multi_index& other) noexcept {
+    std::swap(compares_, other.compares_);
+    swap_trees(other);
+  }
+
+  // Вставляет запись, если ни в одном уникальном индексе нет равного
+  // ключа. Возвращает итератор первого индекса на новую запись или
+  // end<first_tag>()
+  iterator<first_tag> insert(Record const& record) {
+    return emplace(record);
+  }
+  iterator<first_tag> insert(Record&& record) {
+    return emplace(std::move(record));
+  }
+  template <typename... Args>
+  iterator<first_tag> emplace(Args&&... args) {
+    auto* node = new node_t(std::forward<Args>(args)...);
+    std::array<place, sizeof...(Indices)> places;
+    bool free = false;
+    try {
+      free = find_places(*node, places, std::index_sequence_for<Indices...>());
+    } catch (...) {
+      delete node;
+      throw;
+    }
+    if (!free) {
+      delete node;
+      return end<first_tag>();
+    }
+    link(*node, places, std::index_sequence_for<Indices...>());
+    size_++;
+    return iterator<first_tag>(link_of<first_tag>(node));
+  }
+
+  // Удаляет запись из всех индексов, возвращает следующую по индексу Tag
+  template <typename Tag>
+  iterator<Tag> erase(iterator<Tag> it) {
+    iterator<Tag> next = std::next(it);
+    node_t* node = const_cast<node_t*>(it.node());
+    (unlink(link_of<typename Indices::tag>(node)), ...);
+    delete node;
+    size_--;
+    return next;
+  }
+  // Удаляет все записи с ключом key в индексе Tag, возвращает их число
+  template <typename Tag, typename Key>
+  std::size_t erase(Key const& key) {
+    std::size_t count = 0;
+    for (iterator<Tag> it = lower_bound<Tag>(key);
+         it != end<Tag>() && !less<Tag>(key, key_of<Tag>(*it));) {
+      it = erase(it);
+      count++;
+    }
+    return count;
+  }
+
+  // Первая запись с ключом key в индексе Tag или end<Tag>()
+  template <typename Tag, typename Key>
+  iterator<Tag> find(Key const& key) const {
+    iterator<Tag> it = lower_bound<Tag>(key);
+    if (it != end<Tag>() && !less<Tag>(key, key_of<Tag>(*it))) {
+      return it;
+    }
+    return end<Tag>();
+  }
+  template <typename Tag, typename Key>
+  std::size_t count(Key const& key) const {
+    std::size_t res = 0;
+    for (iterator<Tag> it = lower_bound<Tag>(key);
+         it != end<Tag>() && !less<Tag>(key, key_of<Tag>(*it)); ++it) {
+      res++;
+    }
+    return res;
+  }
+
+  template <typename Tag, typename Key>
+  iterator<Tag> lower_bound(Key const& key) const {
+    base_node const* res = &root<Tag>();
+    for (base_node const* it = root<Tag>().left_; it;) {
+      if (less<Tag>(key_of<Tag>(it), key)) {
+        it = it->right_;
+      } else {
+        res = it;
+        it = it->left_;
+      }
+    }
+    return iterator<Tag>(res);
+  }
+  template <typename Tag, typename Key>
+  iterator<Tag> upper_bound(Key const& key) const {
+    base_node const* res = &root<Tag>();
+    for (base_node const* it = root<Tag>().left_; it;) {
+      if (less<Tag>(key, key_of<Tag>(it))) {
+        res = it;
+        it = it->left_;
+      } else {
+        it = it->right_;
+      }
+    }
+    return iterator<Tag>(res);
+  }
+
+  // Та же запись в индексе To, как flip() у итераторов bimap
+  template <typename To, typename From>
+  iterator<To> project(iterator<From> it) const {
+    if (it == end<From>()) {
+      return end<To>();
+    }
+    return iterator<To>(link_of<To>(it.node()));
+  }
+
+  template <typename Tag>
+  iterator<Tag> begin() const {
+    base_node const* it = &root<Tag>();
+    while (it->left_) {
+      it = it->left_;
+    }
+    return iterator<Tag>(it);
+  }
+  template <typename Tag>
+  iterator<Tag> end() const {
+    return iterator<Tag>(&root<Tag>());
+  }
+
+  // Пара begin<Tag>() / end<Tag>() для range-based for
+  template <typename Tag>
+  auto range() const {
+    struct range_t {
+      iterator<Tag> first;
+      iterator<Tag> last;
+      iterator<Tag> begin() const {
+        return first;
+      }
+      iterator<Tag> end() const {
+        return last;
+      }
+    };
+    return range_t{begin<Tag>(), end<Tag>()};
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  // Удаляет все записи. Первое дерево разбирается правыми поворотами без
+  // рекурсии и стека, остальные деревья после этого просто забываются
+  void clear() {
+    base_node* it = root<first_tag>().left_;
+    while (it) {
+      if (base_node* l = it->left_) {
+        it->left_ = l->right_;
+        l->right_ = it;
+        it = l;
+      } else {
+        base_node* r = it->right_;
+        delete node_of<first_tag>(it);
+        it = r;
+      }
+    }
+    (root<typename Indices::tag>().insert_left(nullptr), ...);
+    size_ = 0;
+  }
+
+private:
+  // Лист, к которому прицепится новая вершина
+  struct place {
+    base_node* parent;
+    bool left;
+  };
+
+  template <typename Tag>
+  base_node& root() {
+    return static_cast<intrusive_map::map_node<Tag>&>(roots_);
+  }
+  template <typename Tag>
+  base_node const& root() const {
+    return static_cast<intrusive_map::map_node<Tag> const&>(roots_);
+  }
+
+  template <typename Tag>
+  static base_node* link_of(node_t* node) {
+    return static_cast<intrusive_map::map_node<Tag>*>(node);
+  }
+  template <typename Tag>
+  static base_node const* link_of(node_t const* node) {
+    return static_cast<intrusive_map::map_node<Tag> const*>(node);
+  }
+  template <typename Tag>
+  static node_t* node_of(base_node* p) {
+    return static_cast<node_t*>(static_cast<intrusive_map::map_node<Tag>*>(p));
+  }
+
+  template <typename Tag>
+  static decltype(auto) key_of(Record const& record) {
+    return index_t<Tag>::key(record);
+  }
+  template <typename Tag>
+  static decltype(auto) key_of(base_node const* p) {
+    return key_of<Tag>(iterator<Tag>(p).node()->value_);
+  }
+
+  template <typename Tag, typename A, typename B>
+  bool less(A const& a, B const& b) const {
+    return std::get<position<Tag>()>(compares_)(a, b);
+  }
+
+  // Спуск до листа: в уникальном индексе равный ключ — конфликт, в
+  // неуникальном новая запись идет правее равных
+  template <typename Tag>
+  bool find_place(node_t const& node, place& res) {
+    decltype(auto) key = key_of<Tag>(node.value_);
+    res = {&root<Tag>(), true};
+    for (base_node* it = root<Tag>().left_; it;) {
+      res.parent = it;
+      decltype(auto) it_key = key_of<Tag>(it);
+      res.left = less<Tag>(key, it_key);
+      if (!res.left && index_t<Tag>::unique && !less<Tag>(it_key, key)) {
+        return false;
+      }
+      it = res.left ? it->left_ : it->right_;
+    }
+    return true;
+  }
+
+  template <std::size_t... I>
+  bool find_places(node_t const& node,
+                   std::array<place, sizeof...(Indices)>& places,
+                   std::index_sequence<I...>) {
+    return (find_place<typename Indices::tag>(node, places[I]) && ...);
+  }
+
+  template <std::size_t... I>
+  void link(node_t& node, std::array<place, sizeof...(Indices)> const& places,
+            std::index_sequence<I...>) {
+    (attach(places[I], link_of<typename Indices::tag>(&node)), ...);
+  }
+
+  static void attach(place const& p, base_node* link) {
+    if (p.left) {
+      p.parent->insert_left(link);
+    } else {
+      p.parent->insert_right(link);
+    }
+  }
+
+  // Вырезает вершину из дерева так же, как intrusive_map::erase_impl
+  static void unlink(base_node* it) {
+    if (it->left_ == nullptr) {
+      it->relink_parent(it->right_);
+    } else if (it->right_ == nullptr) {
+      it->relink_parent(it->left_);
+    } else {
+      base_node* next = it->next();
+      unlink(next);
+      it->relink_parent(next);
+      next->insert_left(it->left_);
+      next->insert_right(it->right_);
+    }
+  }
+
+  template <typename Tag>
+  void link_copy(multi_index const& other,
+                 std::vector<std::pair<node_t const*, node_t*>> const& copies) {
+    std::vector<node_t*> order;
+    order.reserve(copies.size());
+    for (auto it = other.begin<Tag>(); it != other.end<Tag>(); ++it) {
+      auto copy = std::lower_bound(
+          copies.begin(), copies.end(), it.node(),
+          [](auto const& a, node_t const* b) {
+            return std::less<>()(a.first, b);
+          });
+      order.push_back(copy->second);
+    }
+    root<Tag>().insert_left(link_balanced<Tag>(order.data(), 0, order.size()));
+  }
+
+  // Глубина рекурсии — высота сбалансированного дерева, O(log n)
+  template <typename Tag>
+  static base_node* link_balanced(node_t* const* nodes, std::size_t lo,
+                                  std::size_t hi) {
+    if (lo == hi) {
+      return nullptr;
+    }
+    std::size_t mid = lo + (hi - lo) / 2;
+    base_node* node = link_of<Tag>(nodes[mid]);
+    node->insert_left(link_balanced<Tag>(nodes, lo, mid));
+    node->insert_right(link_balanced<Tag>(nodes, mid + 1, hi));
+    return node;
+  }
+
+  void swap_trees(multi_index& other) noexcept {
+    (swap_tree<typename Indices::tag>(other), ...);
+    std::swap(size_, other.size_);
+  }
+  template <typename Tag>
+  void swap_tree(multi_index& other) noexcept {
+    base_node* top = root<Tag>().left_;
+    root<Tag>().insert_left(other.root<Tag>().left_);
+    other.root<Tag>().insert_left(top);
+  }
+
+  roots_t roots_;
+  std::size_t size_{0};
+  [[no_unique_address]] std::tuple<typename Indices::compare...> compares_;
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace intrusive_map {
+// Память под N вершин прямо внутри объекта bimap. Маленькая bimap живет
+// целиком в ней и не делает ни одной динамической аллокации, а при росте
+// следующие вершины просто берутся из кучи — деревья от этого не меняются,
+// поэтому итераторы и flip() работают одинаково для любых вершин
+template <typename Node, std::size_t N>
+class inline_node_pool {
+  static_assert(N <= 64, "inline capacity is limited to 64 nodes");
+
+public:
+  inline_node_pool() = default;
+  inline_node_pool(inline_node_pool const&) = delete;
+  inline_node_pool& operator=(inline_node_pool const&) = delete;
+
+  // Возвращает свободный слот или nullptr, если все заняты
+  void* allocate() noexcept {
+    std::size_t i = std::countr_one(used_);
+    if (i >= N) {
+      return nullptr;
+    }
+    used_ |= std::uint64_t(1) << i;
+    return storage_[i].data;
+  }
+
+  void deallocate(void const* p) noexcept {
+    used_ &= ~(std::uint64_t(1) << index(p));
+  }
+
+  bool owns(void const* p) const noexcept {
+    auto const* b = static_cast<std::byte const*>(p);
+    return b >= storage_[0].data && b < storage_[0].data + sizeof(storage_);
+  }
+
+  bool empty() const noexcept {
+    return used_ == 0;
+  }
+
+  bool used(std::size_t i) const noexcept {
+    return (used_ >> i) & 1;
+  }
+
+  Node* slot(std::size_t i) noexcept {
+    return reinterpret_cast<Node*>(storage_[i].data);
+  }
+
+  static constexpr std::size_t capacity() noexcept {
+    return N;
+  }
+
+private:
+  std::size_t index(void const* p) const noexcept {
+    return (static_cast<std::byte const*>(p) - storage_[0].data) /
+           sizeof(slot_t);
+  }
+
+  struct slot_t {
+    alignas(Node) std::byte data[sizeof(Node)];
+  };
+
+  slot_t storage_[N];
+  std::uint64_t used_{0};
+};
+
+template <typename Node>
+class inline_node_pool<Node, 0> {
+public:
+  void* allocate() noexcept {
+    return nullptr;
+  }
+  void deallocate(void const*) noexcept {}
+  bool owns(void const*) const noexcept {
+    return false;
+  }
+  bool empty() const noexcept {
+    return true;
+  }
+  bool used(std::size_t) const noexcept {
+    return false;
+  }
+  Node* slot(std::size_t) noexcept {
+    return nullptr;
+  }
+  static constexpr std::size_t capacity() noexcept {
+    return 0;
+  }
+};
+
+// Один блок под вершины, уложенные подряд (bimap::compact). Слоты выдаются
+// по порядку и не переиспользуются, блок освобождается вместе с последней
+// вершиной в нем
+template <typename Node>
+class node_arena {
+public:
+  node_arena() = default;
+  explicit node_arena(std::size_t capacity)
+      : storage_(new slot_t[capacity]), capacity_(capacity) {}
+  node_arena(node_arena&& other) noexcept {
+    swap(other);
+  }
+  node_arena& operator=(node_arena&& other) noexcept {
+    node_arena tmp(std::move(other));
+    swap(tmp);
+    return *this;
+  }
+
+  void* allocate() noexcept {
+    live_++;
+    return storage_[used_++].data;
+  }
+
+  // Возвращает, освобожден ли блок
+  bool deallocate(void const*) noexcept {
+    if (--live_ != 0) {
+      return false;
+    }
+    storage_.reset();
+    capacity_ = 0;
+    used_ = 0;
+    return true;
+  }
+
+  bool owns(void const* p) const noexcept {
+    auto const* b = static_cast<std::byte const*>(p);
+    return storage_ && b >= storage_[0].data &&
+           b < storage_[0].data + capacity_ * sizeof(slot_t);
+  }
+
+  void swap(node_arena& other) noexcept {
+    std::swap(storage_, other.storage_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(used_, other.used_);
+    std::swap(live_, other.live_);
+  }
+
+private:
+  struct slot_t {
+    alignas(Node) std::byte data[sizeof(Node)];
+  };
+
+  std::unique_ptr<slot_t[]> storage_;
+  std::size_t capacity_{0};
+  std::size_t used_{0};
+  std::size_t live_{0};
+};
+
+struct no_arena {
+  bool deallocate(void const*) noexcept {
+    return false;
+  }
+  bool owns(void const*) const noexcept {
+    return false;
+  }
+  void swap(no_arena&) noexcept {}
+};
+} // namespace intrusive_map
@@ -0,0 +1,711 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace intrusive_map {
+struct base_node;
+
+// Кодирование ключа в байты, сохраняющее порядок: лексикографический порядок
+// кодов (как unsigned char) совпадает с std::less над ключами.
+// bytes(key, buf) возвращает код, buf — место под него, если код не может
+// ссылаться прямо на ключ
+template <typename Key>
+struct radix_key;
+
+// big-endian, у знаковых инвертирован знаковый бит
+template <std::integral Key>
+  requires(!std::is_same_v<Key, bool>)
+struct radix_key<Key> {
+  using buffer_t = std::array<char, sizeof(Key)>;
+  static std::string_view bytes(Key key, buffer_t& buf) {
+    using unsigned_t = std::make_unsigned_t<Key>;
+    auto u = static_cast<unsigned_t>(key);
+    if constexpr (std::is_signed_v<Key>) {
+      u ^= unsigned_t(1) << (sizeof(Key) * CHAR_BIT - 1);
+    }
+    for (std::size_t i = sizeof(Key); i-- > 0;) {
+      buf[i] = static_cast<char>(u & 0xFF);
+      u = static_cast<unsigned_t>(u >> 8);
+    }
+    return {buf.data(), buf.size()};
+  }
+};
+
+template <>
+struct radix_key<std::string_view> {
+  struct buffer_t {};
+  static std::string_view bytes(std::string_view key, buffer_t&) {
+    return key;
+  }
+};
+
+template <>
+struct radix_key<std::string> : radix_key<std::string_view> {};
+
+// Adaptive radix tree: байтовая строка -> вершина bimap. Внутренние узлы
+// растут и сжимаются между Node4, Node16, Node48 и Node256 по числу детей,
+// общие участки путей хранятся в prefix_ узла (сжатие путей). Ключ, который
+// является префиксом других ключей, лежит в terminal_ узла, где он кончается
+class radix_tree {
+public:
+  using value_t = base_node const*;
+
+  radix_tree() = default;
+  radix_tree(radix_tree const&) = delete;
+  radix_tree& operator=(radix_tree const&) = delete;
+  radix_tree(radix_tree&& other) noexcept
+      : root_(std::exchange(other.root_, nullptr)) {}
+  radix_tree& operator=(radix_tree&& other) noexcept {
+    radix_tree tmp(std::move(other));
+    swap(tmp);
+    return *this;
+  }
+  ~radix_tree() {
+    destroy(root_);
+  }
+
+  void swap(radix_tree& other) noexcept {
+    std::swap(root_, other.root_);
+  }
+
+  // key не должен присутствовать в дереве. Если выделение памяти бросает,
+  // дерево не меняется
+  void insert(std::string_view key, value_t value) {
+    auto l = std::make_unique<leaf>(key, value);
+    insert(root_, l.get(), 0);
+    l.release();
+  }
+  // Не бросает: если на сжатие узла не хватило памяти, узел остается
+  // прежнего размера
+  void erase(std::string_view key) noexcept {
+    erase(root_, key, 0);
+  }
+
+  // nullptr, если ключа нет
+  value_t find(std::string_view key) const {
+    leaf* l = find_leaf(key);
+    return l ? l->value_ : nullptr;
+  }
+  // Меняет значение существующего ключа
+  void assign(std::string_view key, value_t value) {
+    find_leaf(key)->value_ = value;
+  }
+
+  // Значение минимального ключа >= key (> key для upper_bound) или nullptr
+  value_t lower_bound(std::string_view key) const {
+    leaf* l = bound(root_, key, 0, false);
+    return l ? l->value_ : nullptr;
+  }
+  value_t upper_bound(std::string_view key) const {
+    leaf* l = bound(root_, key, 0, true);
+    return l ? l->value_ : nullptr;
+  }
+
+private:
+  enum class kind : std::uint8_t { leaf, n4, n16, n48, n256 };
+
+  struct node {
+    kind kind_;
+  };
+  struct leaf : node {
+    leaf(std::string_view key, value_t value)
+        : node{kind::leaf}, key_(key), value_(value) {}
+    std::string key_;
+    value_t value_;
+  };
+  struct inner : node {
+    std::string prefix_;
+    leaf* terminal_{nullptr};
+    std::uint16_t count_{0};
+  };
+  // Node4 и Node16: отсортированные байты и дети на тех же позициях
+  template <kind K, std::size_t N>
+  struct sorted_node : inner {
+    sorted_node() : inner{{K}, {}, nullptr, 0} {}
+    std::uint8_t keys_[N];
+    node* children_[N];
+  };
+  using node4 = sorted_node<kind::n4, 4>;
+  using node16 = sorted_node<kind::n16, 16>;
+  // index_[b] — позиция ребенка по байту b плюс один, 0 — ребенка нет
+  struct node48 : inner {
+    node48() : inner{{kind::n48}, {}, nullptr, 0} {}
+    std::uint8_t index_[256]{};
+    node* children_[48];
+  };
+  struct node256 : inner {
+    node256() : inner{{kind::n256}, {}, nullptr, 0} {}
+    node* children_[256]{};
+  };
+
+  static std::uint8_t byte(std::string_view s, std::size_t i) {
+    return static_cast<unsigned char>(s[i]);
+  }
+
+  // Длина общего начала строк
+  static std::size_t common(std::string_view a, std::string_view b) {
+    std::size_t n = std::min(a.size(), b.size());
+    std::size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+      i++;
+    }
+    return i;
+  }
+
+  static std::size_t capacity(kind k) {
+    switch (k) {
+    case kind::n4:
+      return 4;
+    case kind::n16:
+      return 16;
+    case kind::n48:
+      return 48;
+    default:
+      return 256;
+    }
+  }
+
+  static inner* make(kind k) {
+    switch (k) {
+    case kind::n4:
+      return new node4();
+    case kind::n16:
+      return new node16();
+    case kind::n48:
+      return new node48();
+    default:
+      return new node256();
+    }
+  }
+
+  static void free_node(node* n) {
+    switch (n->kind_) {
+    case kind::leaf:
+      delete static_cast<leaf*>(n);
+      break;
+    case kind::n4:
+      delete static_cast<node4*>(n);
+      break;
+    case kind::n16:
+      delete static_cast<node16*>(n);
+      break;
+    case kind::n48:
+      delete static_cast<node48*>(n);
+      break;
+    case kind::n256:
+      delete static_cast<node256*>(n);
+      break;
+    }
+  }
+
+  static void destroy(node* n) {
+    if (n == nullptr) {
+      return;
+    }
+    if (n->kind_ != kind::leaf) {
+      auto* in = static_cast<inner*>(n);
+      destroy(in->terminal_);
+      for_each_child(in, [](std::uint8_t, node* c) { destroy(c); });
+    }
+    free_node(n);
+  }
+
+  // Дети в порядке возрастания байта
+  template <typename F>
+  static void for_each_child(inner const* n, F f) {
+    switch (n->kind_) {
+    case kind::n4: {
+      auto const* m = static_cast<node4 const*>(n);
+      for (std::size_t i = 0; i < m->count_; i++) {
+        f(m->keys_[i], m->children_[i]);
+      }
+      break;
+    }
+    case kind::n16: {
+      auto const* m = static_cast<node16 const*>(n);
+      for (std::size_t i = 0; i < m->count_; i++) {
+        f(m->keys_[i], m->children_[i]);
+      }
+      break;
+    }
+    case kind::n48: {
+      auto const* m = static_cast<node48 const*>(n);
+      for (std::size_t b = 0; b < 256; b++) {
+        if (m->index_[b]) {
+          f(static_cast<std::uint8_t>(b), m->children_[m->index_[b] - 1]);
+        }
+      }
+      break;
+    }
+    default: {
+      auto const* m = static_cast<node256 const*>(n);
+      for (std::size_t b = 0; b < 256; b++) {
+        if (m->children_[b]) {
+          f(static_cast<std::uint8_t>(b), m->children_[b]);
+        }
+      }
+      break;
+    }
+    }
+  }
+
+  template <typename Sorted>
+  static node** sorted_child(Sorted* n, std::uint8_t b) {
+    for (std::size_t i = 0; i < n->count_; i++) {
+      if (n->keys_[i] == b) {
+        return &n->children_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // Ссылка на ребенка по байту или nullptr
+  static node** child(inner* n, std::uint8_t b) {
+    switch (n->kind_) {
+    case kind::n4:
+      return sorted_child(static_cast<node4*>(n), b);
+    case kind::n16:
+      return sorted_child(static_cast<node16*>(n), b);
+    case kind::n48: {
+      auto* m = static_cast<node48*>(n);
+      return m->index_[b] ? &m->children_[m->index_[b] - 1] : nullptr;
+    }
+    default: {
+      auto* m = static_cast<node256*>(n);
+      return m->children_[b] ? &m->children_[b] : nullptr;
+    }
+    }
+  }
+
+  template <typename Sorted>
+  static node* sorted_child_from(Sorted const* n, std::size_t b) {
+    for (std::size_t i = 0; i < n->count_; i++) {
+      if (n->keys_[i] >= b) {
+        return n->children_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // Первый ребенок с байтом >= b (b может быть 256)
+  static node* child_from(inner const* n, std::size_t b) {
+    switch (n->kind_) {
+    case kind::n4:
+      return sorted_child_from(static_cast<node4 const*>(n), b);
+    case kind::n16:
+      return sorted_child_from(static_cast<node16 const*>(n), b);
+    case kind::n48: {
+      auto const* m = static_cast<node48 const*>(n);
+      for (; b < 256; b++) {
+        if (m->index_[b]) {
+          return m->children_[m->index_[b] - 1];
+        }
+      }
+      return nullptr;
+    }
+    default: {
+      auto const* m = static_cast<node256 const*>(n);
+      for (; b < 256; b++) {
+        if (m->children_[b]) {
+          return m->children_[b];
+        }
+      }
+      return nullptr;
+    }
+    }
+  }
+
+  template <typename Sorted>
+  static void sorted_put(Sorted* n, std::uint8_t b, node* c) {
+    std::size_t i = n->count_;
+    for (; i > 0 && n->keys_[i - 1] > b; i--) {
+      n->keys_[i] = n->keys_[i - 1];
+      n->children_[i] = n->children_[i - 1];
+    }
+    n->keys_[i] = b;
+    n->children_[i] = c;
+  }
+
+  // Добавляет ребенка в узел, в котором есть место
+  static void put(inner* n, std::uint8_t b, node* c) {
+    switch (n->kind_) {
+    case kind::n4:
+      sorted_put(static_cast<node4*>(n), b, c);
+      break;
+    case kind::n16:
+      sorted_put(static_cast<node16*>(n), b, c);
+      break;
+    case kind::n48: {
+      auto* m = static_cast<node48*>(n);
+      m->children_[m->count_] = c;
+      m->index_[b] = static_cast<std::uint8_t>(m->count_ + 1);
+      break;
+    }
+    default:
+      static_cast<node256*>(n)->children_[b] = c;
+      break;
+    }
+    n->count_++;
+  }
+
+  template <typename Sorted>
+  static void sorted_remove(Sorted* n, std::uint8_t b) {
+    std::size_t i = 0;
+    while (n->keys_[i] != b) {
+      i++;
+    }
+    for (; i + 1 < n->count_; i++) {
+      n->keys_[i] = n->keys_[i + 1];
+      n->children_[i] = n->children_[i + 1];
+    }
+  }
+
+  // В Node48 дети лежат подряд: на место удаленного переезжает последний
+  static void remove(inner* n, std::uint8_t b) {
+    switch (n->kind_) {
+    case kind::n4:
+      sorted_remove(static_cast<node4*>(n), b);
+      break;
+    case kind::n16:
+      sorted_remove(static_cast<node16*>(n), b);
+      break;
+    case kind::n48: {
+      auto* m = static_cast<node48*>(n);
+      std::uint8_t pos = m->index_[b];
+      m->index_[b] = 0;
+      if (pos != m->count_) {
+        m->children_[pos - 1] = m->children_[m->count_ - 1];
+        for (std::size_t i = 0; i < 256; i++) {
+          if (m->index_[i] == m->count_) {
+            m->index_[i] = pos;
+            break;
+          }
+        }
+      }
+      break;
+    }
+    default:
+      static_cast<node256*>(n)->children_[b] = nullptr;
+      break;
+    }
+    n->count_--;
+  }
+
+  // Переносит содержимое n в новый узел типа k
+  static inner* resize(inner* n, kind k) {
+    inner* m = make(k);
+    m->prefix_ = std::move(n->prefix_);
+    m->terminal_ = n->terminal_;
+    for_each_child(n, [m](std::uint8_t b, node* c) { put(m, b, c); });
+    free_node(n);
+    return m;
+  }
+
+  // ref — ссылка на n в родителе, она меняется, если узел пришлось заменить
+  static void add_child(node*& ref, inner* n, std::uint8_t b, node* c) {
+    if (n->count_ == capacity(n->kind_)) {
+      n = resize(n, static_cast<kind>(static_cast<int>(n->kind_) + 1));
+      ref = n;
+    }
+    put(n, b, c);
+  }
+  static void remove_child(node*& ref, inner* n, std::uint8_t b) noexcept {
+    remove(n, b);
+    if ((n->kind_ == kind::n16 && n->count_ <= 3) ||
+        (n->kind_ == kind::n48 && n->count_ <= 12) ||
+        (n->kind_ == kind::n256 && n->count_ <= 37)) {
+      try {
+        ref = resize(n, static_cast<kind>(static_cast<int>(n->kind_) - 1));
+      } catch (...) {
+        // Лишнее место в узле не мешает поиску
+      }
+    }
+  }
+
+  // Кладет лист в новый узел n, путь до которого имеет длину depth. В
+  // новом Node4 всегда есть место, поэтому рост узла здесь не нужен
+  static void place(inner* n, leaf* l, std::size_t depth) {
+    if (l->key_.size() == depth) {
+      n->terminal_ = l;
+    } else {
+      put(n, byte(l->key_, depth), l);
+    }
+  }
+
+  static void insert(node*& ref, leaf* l, std::size_t depth) {
+    std::string_view key = l->key_;
+    if (ref == nullptr) {
+      ref = l;
+      return;
+    }
+    if (ref->kind_ == kind::leaf) {
+      auto* e = static_cast<leaf*>(ref);
+      std::size_t c =
+          common(std::string_view(e->key_).substr(depth), key.substr(depth));
+      std::string prefix(key.substr(depth, c));
+      inner* n = make(kind::n4);
+      n->prefix_ = std::move(prefix);
+      ref = n;
+      place(n, e, depth + c);
+      place(n, l, depth + c);
+      return;
+    }
+    auto* n = static_cast<inner*>(ref);
+    std::size_t m = common(n->prefix_, key.substr(depth));
+    if (m < n->prefix_.size()) {
+      std::string prefix = n->prefix_.substr(0, m);
+      inner* parent = make(kind::n4);
+      parent->prefix_ = std::move(prefix);
+      std::uint8_t b = byte(n->prefix_, m);
+      n->prefix_.erase(0, m + 1);
+      ref = parent;
+      put(parent, b, n);
+      place(parent, l, depth + m);
+      return;
+    }
+    depth += n->prefix_.size();
+    if (depth == key.size()) {
+      n->terminal_ = l;
+      return;
+    }
+    if (node** c = child(n, byte(key, depth))) {
+      insert(*c, l, depth + 1);
+      return;
+    }
+    add_child(ref, n, byte(key, depth), l);
+  }
+
+  static bool erase(node*& ref, std::string_view key,
+                    std::size_t depth) noexcept {
+    if (ref == nullptr) {
+      return false;
+    }
+    if (ref->kind_ == kind::leaf) {
+      if (static_cast<leaf*>(ref)->key_ != key) {
+        return false;
+      }
+      free_node(ref);
+      ref = nullptr;
+      return true;
+    }
+    auto* n = static_cast<inner*>(ref);
+    if (!key.substr(depth).starts_with(n->prefix_)) {
+      return false;
+    }
+    depth += n->prefix_.size();
+    if (depth == key.size()) {
+      if (n->terminal_ == nullptr) {
+        return false;
+      }
+      free_node(n->terminal_);
+      n->terminal_ = nullptr;
+    } else {
+      std::uint8_t b = byte(key, depth);
+      node** c = child(n, b);
+      if (c == nullptr || !erase(*c, key, depth + 1)) {
+        return false;
+      }
+      if (*c == nullptr) {
+        remove_child(ref, n, b);
+      }
+    }
+    collapse(ref);
+    return true;
+  }
+
+  // У внутреннего узла обычно не меньше двух записей (дети и terminal_):
+  // узел с одной записью заменяется ею. Если на склейку префиксов не
+  // хватило памяти, узел с одним ребенком остается, поиску он не мешает
+  static void collapse(node*& ref) noexcept {
+    auto* n = static_cast<inner*>(ref);
+    if (n->count_ == 0) {
+      ref = n->terminal_;
+      free_node(n);
+      return;
+    }
+    if (n->count_ == 1 && n->terminal_ == nullptr) {
+      std::uint8_t b = 0;
+      node* c = nullptr;
+      for_each_child(n, [&](std::uint8_t cb, node* cn) {
+        b = cb;
+        c = cn;
+      });
+      if (c->kind_ != kind::leaf) {
+        auto* ci = static_cast<inner*>(c);
+        try {
+          std::string prefix;
+          prefix.reserve(n->prefix_.size() + 1 + ci->prefix_.size());
+          prefix.append(n->prefix_);
+          prefix.push_back(static_cast<char>(b));
+          prefix.append(ci->prefix_);
+          ci->prefix_ = std::move(prefix);
+        } catch (...) {
+          return;
+        }
+      }
+      ref = c;
+      free_node(n);
+    }
+  }
+
+  leaf* find_leaf(std::string_view key) const {
+    node* n = root_;
+    std::size_t depth = 0;
+    while (n != nullptr) {
+      if (n->kind_ == kind::leaf) {
+        auto* l = static_cast<leaf*>(n);
+        return l->key_ == key ? l : nullptr;
+      }
+      auto* in = static_cast<inner*>(n);
+      if (!key.substr(depth).starts_with(in->prefix_)) {
+        return nullptr;
+      }
+      depth += in->prefix_.size();
+      if (depth == key.size()) {
+        return in->terminal_;
+      }
+      node** c = child(in, byte(key, depth++));
+      n = c ? *c : nullptr;
+    }
+    return nullptr;
+  }
+
+  static leaf* minimum(node* n) {
+    while (n != nullptr && n->kind_ != kind::leaf) {
+      auto* in = static_cast<inner*>(n);
+      if (in->terminal_) {
+        return in->terminal_;
+      }
+      n = child_from(in, 0);
+    }
+    return static_cast<leaf*>(n);
+  }
+
+  // Минимальный лист поддерева n с ключом >= key (> key при strict),
+  // первые depth байт всех ключей поддерева совпадают с key
+  static leaf* bound(node* n, std::string_view key, std::size_t depth,
+                     bool strict) {
+    if (n == nullptr) {
+      return nullptr;
+    }
+    if (n->kind_ == kind::leaf) {
+      auto* l = static_cast<leaf*>(n);
+      int c = std::string_view(l->key_).compare(key);
+      return (strict ? c > 0 : c >= 0) ? l : nullptr;
+    }
+    auto* in = static_cast<inner*>(n);
+    std::string_view rest = key.substr(depth);
+    std::size_t m = common(in->prefix_, rest);
+    if (m < in->prefix_.size()) {
+      // key кончился или меньше на первом отличии — все поддерево больше
+      if (m == rest.size() || byte(in->prefix_, m) > byte(rest, m)) {
+        return minimum(n);
+      }
+      return nullptr;
+    }
+    depth += in->prefix_.size();
+    if (depth == key.size()) {
+      if (!strict && in->terminal_) {
+        return in->terminal_;
+      }
+      return minimum(child_from(in, 0));
+    }
+    std::uint8_t b = byte(key, depth);
+    if (node** c = child(in, b)) {
+      if (leaf* l = bound(*c, key, depth + 1, strict)) {
+        return l;
+      }
+    }
+    return minimum(child_from(in, std::size_t(b) + 1));
+  }
+
+  node* root_{nullptr};
+};
+
+// Индексы стороны bimap, см. Policy::left_index / right_index. enabled —
+// индекс отвечает на find для ключей с covers(key), ordered — еще и на
+// lower_bound / upper_bound
+
+// Поиск идет по дереву сравнений
+struct no_index {};
+// Поиск и выбор места при вставке идут по adaptive radix tree над
+// radix_key<Key>, сравнение ключей не вызывается: дерево стороны нужно
+// только для обхода. Порядок стороны должен быть std::less
+struct radix_index {};
+
+template <typename Tag, typename Key, typename Compare, typename Index>
+class side_index;
+
+template <typename Tag, typename Key, typename Compare>
+class side_index<Tag, Key, Compare, no_index> {
+public:
+  static constexpr bool enabled = false;
+  static constexpr bool ordered = false;
+  void insert(Key const&, base_node const*) {}
+  void erase(Key const&) noexcept {}
+  void assign(Key const&, base_node const*) {}
+  void swap(side_index&) noexcept {}
+};
+
+// Индекс ссылается на вершины стороны Tag: он обновляется при вставке,
+// удалении и смене ключа, а при переезде вершины из встроенного буфера
+// получает новый адрес через assign
+template <typename Tag, typename Key, typename Compare>
+class side_index<Tag, Key, Compare, radix_index> {
+  static_assert(std::is_same_v<Compare, std::less<Key>> ||
+                    std::is_same_v<Compare, std::less<>>,
+                "radix_index requires std::less ordering of the side");
+  using encoding = radix_key<Key>;
+
+public:
+  static constexpr bool enabled = true;
+  static constexpr bool ordered = true;
+
+  void insert(Key const& key, base_node const* node) {
+    typename encoding::buffer_t buf;
+    tree_.insert(encoding::bytes(key, buf), node);
+  }
+  void erase(Key const& key) noexcept {
+    typename encoding::buffer_t buf;
+    tree_.erase(encoding::bytes(key, buf));
+  }
+  void assign(Key const& key, base_node const* node) {
+    typename encoding::buffer_t buf;
+    tree_.assign(encoding::bytes(key, buf), node);
+  }
+  void swap(side_index& other) noexcept {
+    tree_.swap(other.tree_);
+  }
+
+  // Индекс содержит все ключи стороны
+  bool covers(Key const&) const {
+    return true;
+  }
+  base_node const* find(Key const& key) const {
+    typename encoding::buffer_t buf;
+    return tree_.find(encoding::bytes(key, buf));
+  }
+  base_node const* lower_bound(Key const& key) const {
+    typename encoding::buffer_t buf;
+    return tree_.lower_bound(encoding::bytes(key, buf));
+  }
+  base_node const* upper_bound(Key const& key) const {
+    typename encoding::buffer_t buf;
+    return tree_.upper_bound(encoding::bytes(key, buf));
+  }
+
+private:
+  radix_tree tree_;
+};
+} // namespace intrusive_map
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <functional>
+#include <utility>
+
+namespace intrusive_map {
+// Звено кольцевого интрузивного списка давности, пустой список — звено,
+// замкнутое само на себя. Порядок давности не входит в наблюдаемое
+// состояние bimap, поэтому звенья меняются и у const вершин (поиск в const
+// bimap тоже отмечает пару как свежую)
+struct recency_link {
+  recency_link() noexcept = default;
+  recency_link(recency_link const&) noexcept {}
+  // Как и base_node, перевешивает соседей на новый адрес
+  recency_link(recency_link&& rhs) noexcept {
+    adopt(rhs);
+  }
+  recency_link& operator=(recency_link const&) = delete;
+  ~recency_link() {
+    unlink();
+  }
+
+  bool linked() const {
+    return next_ != this;
+  }
+
+  void unlink() const {
+    prev_->next_ = next_;
+    next_->prev_ = prev_;
+    prev_ = this;
+    next_ = this;
+  }
+
+  void link_before(recency_link const& pos) const {
+    prev_ = pos.prev_;
+    next_ = &pos;
+    prev_->next_ = this;
+    pos.prev_ = this;
+  }
+
+  // Занимает место rhs в его списке, rhs остается пустым. this должно быть
+  // пустым
+  void adopt(recency_link& rhs) noexcept {
+    if (!rhs.linked()) {
+      return;
+    }
+    prev_ = rhs.prev_;
+    next_ = rhs.next_;
+    prev_->next_ = this;
+    next_->prev_ = this;
+    rhs.prev_ = &rhs;
+    rhs.next_ = &rhs;
+  }
+
+  void swap(recency_link& other) noexcept {
+    recency_link tmp(std::move(other));
+    other.adopt(*this);
+    adopt(tmp);
+  }
+
+  mutable recency_link const* prev_{this};
+  mutable recency_link const* next_{this};
+};
+
+template <bool Enabled>
+struct recency_slot : recency_link {};
+
+template <>
+struct recency_slot<false> {};
+
+// Список давности bimap с Policy::lru_capacity: от самой давней пары
+// (head_.next_) к самой свежей (head_.prev_)
+template <typename Left, typename Right>
+struct recency_list {
+  void push(recency_link const& link) const {
+    link.link_before(head_);
+  }
+  void touch(recency_link const& link) const {
+    link.unlink();
+    link.link_before(head_);
+  }
+  recency_link const* oldest() const {
+    return head_.next_;
+  }
+  recency_link const* end() const {
+    return &head_;
+  }
+
+  // Отцепляет голову от вершин, которые дальше разбираются без bimap
+  void detach() const noexcept {
+    head_.unlink();
+  }
+
+  void take(recency_list& other) noexcept {
+    head_.adopt(other.head_);
+    on_evict_ = std::move(other.on_evict_);
+  }
+  void swap(recency_list& other) noexcept {
+    head_.swap(other.head_);
+    std::swap(on_evict_, other.on_evict_);
+  }
+
+  recency_link head_;
+  std::function<void(Left const&, Right const&)> on_evict_;
+};
+
+struct no_recency {
+  void detach() const noexcept {}
+  void take(no_recency&) noexcept {}
+  void swap(no_recency&) noexcept {}
+};
+} // namespace intrusive_map
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace intrusive_map {
+// Отцепленный набор вершин, который разбирается в фоновом потоке
+struct reclaim_job {
+  virtual ~reclaim_job() = default;
+  virtual void run() noexcept = 0;
+};
+
+// Фоновый поток для Policy::background_reclaim_threshold: bimap отдает ему
+// отцепленные деревья и сразу возвращается, а деструкторы ключей и
+// освобождение памяти выполняются здесь. Один поток на процесс, он
+// запускается при первой передаче и живет до конца процесса (объект
+// намеренно не разрушается, чтобы статические bimap могли передавать
+// вершины и при выходе); не разобранное к выходу освобождает ОС
+class background_reclaimer {
+public:
+  static background_reclaimer& instance() {
+    static auto* reclaimer = new background_reclaimer();
+    return *reclaimer;
+  }
+
+  // Если поток или очередь недоступны, job выполняется сразу
+  void post(std::unique_ptr<reclaim_job> job) noexcept {
+    try {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!worker_.joinable()) {
+        worker_ = std::thread([this] { work(); });
+      }
+      jobs_.push_back(std::move(job));
+    } catch (...) {
+      job->run();
+      return;
+    }
+    ready_.notify_one();
+  }
+
+  // Ждет, пока не будет разобрано все переданное до вызова
+  void drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return jobs_.empty() && !running_; });
+  }
+
+  // Сколько наборов вершин уже разобрано
+  std::size_t completed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return completed_;
+  }
+
+private:
+  background_reclaimer() = default;
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      ready_.wait(lock, [this] { return !jobs_.empty(); });
+      std::unique_ptr<reclaim_job> job = std::move(jobs_.front());
+      jobs_.pop_front();
+      running_ = true;
+      lock.unlock();
+      job->run();
+      job.reset();
+      lock.lock();
+      running_ = false;
+      completed_++;
+      if (jobs_.empty()) {
+        idle_.notify_all();
+      }
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable ready_;
+  std::condition_variable idle_;
+  std::deque<std::unique_ptr<reclaim_job>> jobs_;
+  std::thread worker_;
+  bool running_{false};
+  std::size_t completed_{0};
+};
+} // namespace intrusive_map
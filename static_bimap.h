@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+// bimap из фиксированного набора пар, который целиком строится во время
+// компиляции: пары лежат в массиве, отсортированном по left, и индексы пар
+// отсортированы по right, поиск — двоичный. Нет ни вершин, ни аллокаций.
+// Left и Right должны быть literal и default constructible, например
+//   constexpr auto opcodes = make_static_bimap<op, std::string_view>(
+//       {{op::add, "add"}, {op::sub, "sub"}});
+//   static_assert(opcodes.at_right("sub") == op::sub);
+// Повтор left или right — ошибка компиляции при константном вычислении
+template <typename Left, typename Right, std::size_t N,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+class static_bimap {
+public:
+  using value_type = std::pair<Left, Right>;
+  using iterator = value_type const*;
+
+  constexpr static_bimap(value_type const (&pairs)[N],
+                         CompareLeft compare_left = CompareLeft(),
+                         CompareRight compare_right = CompareRight())
+      : compare_left_(std::move(compare_left)),
+        compare_right_(std::move(compare_right)) {
+    for (std::size_t i = 0; i < N; i++) {
+      by_left_[i] = pairs[i];
+    }
+    std::sort(by_left_.begin(), by_left_.end(),
+              [this](value_type const& a, value_type const& b) {
+                return compare_left_(a.first, b.first);
+              });
+    for (std::size_t i = 0; i < N; i++) {
+      by_right_[i] = i;
+    }
+    std::sort(by_right_.begin(), by_right_.end(),
+              [this](std::size_t a, std::size_t b) {
+                return compare_right_(by_left_[a].second, by_left_[b].second);
+              });
+    for (std::size_t i = 1; i < N; i++) {
+      if (!compare_left_(by_left_[i - 1].first, by_left_[i].first)) {
+        throw std::invalid_argument("duplicate left key");
+      }
+      if (!compare_right_(right(i - 1), right(i))) {
+        throw std::invalid_argument("duplicate right key");
+      }
+    }
+  }
+
+  // Пара по ключу своей стороны или end()
+  constexpr iterator find_left(Left const& key) const {
+    std::size_t i = lower_bound(
+        [&](std::size_t j) { return compare_left_(by_left_[j].first, key); });
+    return i < N && !compare_left_(key, by_left_[i].first) ? &by_left_[i]
+                                                            : end();
+  }
+  constexpr iterator find_right(Right const& key) const {
+    std::size_t i = lower_bound(
+        [&](std::size_t j) { return compare_right_(right(j), key); });
+    return i < N && !compare_right_(key, right(i)) ? &by_left_[by_right_[i]]
+                                                   : end();
+  }
+
+  // Если ключа нет -- бросает std::out_of_range
+  constexpr Right const& at_left(Left const& key) const {
+    iterator it = find_left(key);
+    if (it == end()) {
+      throw std::out_of_range("invalid key");
+    }
+    return it->second;
+  }
+  constexpr Left const& at_right(Right const& key) const {
+    iterator it = find_right(key);
+    if (it == end()) {
+      throw std::out_of_range("invalid key");
+    }
+    return it->first;
+  }
+
+  // Пары в порядке left
+  constexpr iterator begin() const {
+    return by_left_.data();
+  }
+  constexpr iterator end() const {
+    return by_left_.data() + N;
+  }
+
+  static constexpr std::size_t size() {
+    return N;
+  }
+  static constexpr bool empty() {
+    return N == 0;
+  }
+
+private:
+  // i-й по порядку right
+  constexpr Right const& right(std::size_t i) const {
+    return by_left_[by_right_[i]].second;
+  }
+
+  // Первая позиция i, для которой less(i) == false
+  template <typename Less>
+  static constexpr std::size_t lower_bound(Less less) {
+    std::size_t lo = 0;
+    std::size_t hi = N;
+    while (lo < hi) {
+      std::size_t mid = lo + (hi - lo) / 2;
+      if (less(mid)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  [[no_unique_address]] CompareLeft compare_left_;
+  [[no_unique_address]] CompareRight compare_right_;
+  std::array<value_type, N> by_left_{};
+  std::array<std::size_t, N> by_right_{};
+};
+
+// Вычисляется только во время компиляции, поэтому повторяющиеся ключи
+// не дойдут до рантайма
+template <typename Left, typename Right, std::size_t N,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+consteval static_bimap<Left, Right, N, CompareLeft, CompareRight>
+make_static_bimap(std::pair<Left, Right> const (&pairs)[N]) {
+  return {pairs};
+}
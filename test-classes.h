@@ -1,5 +1,8 @@
 #pragma once
 
+#include <compare>
+#include <stdexcept>
+
 struct test_object {
   int a = 0;
   test_object() = default;
@@ -41,6 +44,43 @@ private:
   distance_type type;
 };
 
+// Копирование бросает, пока fail выставлен
+struct throwing_copy {
+  static inline bool fail = false;
+  int a = 0;
+  explicit throwing_copy(int b) : a(b) {}
+  throwing_copy(throwing_copy const& other) : a(other.a) {
+    if (fail) {
+      throw std::runtime_error("copy failed");
+    }
+  }
+  throwing_copy(throwing_copy&&) noexcept = default;
+  throwing_copy& operator=(throwing_copy const&) = default;
+  throwing_copy& operator=(throwing_copy&&) noexcept = default;
+  friend bool operator<(throwing_copy const& c, throwing_copy const& b) {
+    return c.a < b.a;
+  }
+  friend bool operator==(throwing_copy const& c, throwing_copy const& b) {
+    return c.a == b.a;
+  }
+};
+
+// Бросает на любом сравнении с 13
+struct unlucky_compare {
+  bool operator()(int a, int b) const {
+    if (a == 13 || b == 13) {
+      throw std::runtime_error("unlucky key");
+    }
+    return a < b;
+  }
+};
+
+struct three_way_int_compare {
+  std::strong_ordering operator()(int a, int b) const {
+    return a <=> b;
+  }
+};
+
 struct non_default_constructible {
   non_default_constructible() = delete;
   explicit non_default_constructible(int b) : a(b) {}
@@ -1,9 +1,25 @@
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
 #include <random>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 #include "bimap.h"
+#include "bimap_algorithms.h"
+#include "concurrent_bimap.h"
+#include "multi_index.h"
+#include "static_bimap.h"
+#include "trace.h"
 #include "test-classes.h"
 #include "gtest/gtest.h"
 
+static constexpr uint32_t seed = 1488228;
+
 TEST(bimap, leak_check) {
   bimap<unsigned long, unsigned long> b;
 
@@ -131,6 +147,47 @@ TEST(bimap, at_or_default) {
   EXPECT_EQ(b.at_left(0), 1000);
 }
 
+TEST(bimap, at_or_default_existing) {
+  bimap<int, int> b;
+  b.insert(4, 2);
+  b.insert(0, 7);
+  EXPECT_EQ(b.at_left_or_default(4), 2);
+  EXPECT_EQ(b.at_right_or_default(7), 0);
+  EXPECT_EQ(b.size(), 2);
+}
+
+TEST(bimap, replace) {
+  bimap<int, int> b;
+  for (int i = 0; i < 10; i++) {
+    b.insert(i, i * 10);
+  }
+  auto lit = b.find_left(3);
+  auto rit = lit.flip();
+
+  auto res = b.replace_left(rit, 42);
+  EXPECT_EQ(res, lit);
+  EXPECT_EQ(*lit, 42);
+  EXPECT_EQ(b.at_right(30), 42);
+  EXPECT_EQ(b.find_left(3), b.end_left());
+  EXPECT_EQ(*--b.end_left(), 42);
+
+  EXPECT_EQ(b.replace_left(rit, 5), b.end_left());
+  EXPECT_EQ(b.at_left(42), 30);
+  EXPECT_EQ(b.replace_left(rit, 42), lit);
+
+  EXPECT_EQ(b.replace_right(lit, -1), rit);
+  EXPECT_EQ(*b.begin_right(), -1);
+  EXPECT_EQ(b.at_left(42), -1);
+  EXPECT_EQ(b.replace_right(b.begin_left(), 50), b.end_right());
+  EXPECT_EQ(b.size(), 10);
+
+  std::vector<int> lefts;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    lefts.push_back(*it);
+  }
+  EXPECT_EQ(lefts, (std::vector<int>{0, 1, 2, 4, 5, 6, 7, 8, 9, 42}));
+}
+
 TEST(bimap, end_flip) {
   bimap<int, int> b;
   EXPECT_EQ(b.end_left().flip(), b.end_right());
@@ -391,6 +448,1537 @@ TEST(bimap, swap) {
   EXPECT_EQ(*b.find_right(3), 3);
 }
 
+struct counting_policy : intrusive_map::default_policy {
+  using stats = intrusive_map::counting_stats;
+};
+
+TEST(bimap, stats) {
+  bimap<int, int, std::less<int>, std::less<int>, counting_policy> b;
+  b.insert(2, 20);
+  b.insert(1, 10);
+  b.insert(3, 30);
+  b.reset_stats();
+
+  EXPECT_EQ(b.at_left(3), 30);
+  auto s = b.stats();
+  EXPECT_EQ(s.left.searches, 1);
+  EXPECT_EQ(s.left.depth_histogram[3], 1);
+  EXPECT_EQ(s.left.max_depth, 3);
+  EXPECT_GT(s.left.comparisons, 0);
+  EXPECT_EQ(s.right.searches, 0);
+
+  b.erase_left(1);
+  b.insert(4, 40);
+  s = b.stats();
+  EXPECT_EQ(s.nodes.allocations, 1);
+  EXPECT_EQ(s.nodes.frees, 1);
+  EXPECT_EQ(s.left.restructures, 2);
+  EXPECT_EQ(s.right.restructures, 2);
+
+  // Удаление вершины с двумя детьми — одна перестройка
+  b.insert(1, 10);
+  b.reset_stats();
+  b.erase_left(2);
+  EXPECT_EQ(b.stats().left.restructures, 1);
+}
+
+TEST(bimap, stats_disabled) {
+  EXPECT_EQ(sizeof(bimap<int, int>), sizeof(intrusive_map::empty_bimap_node) +
+                                         sizeof(void*) * 2 + sizeof(size_t));
+}
+
+TEST(bimap, shape) {
+  bimap<int, int> b;
+  EXPECT_EQ(b.height_left(), 0);
+  EXPECT_EQ(b.shape_right().average_depth(), 0.0);
+
+  int order = 0;
+  for (int i : {4, 2, 6, 1, 3, 5, 7}) {
+    b.insert(i, order++);
+  }
+  auto left = b.shape_left();
+  EXPECT_EQ(left.size, 7);
+  EXPECT_EQ(left.height, 3);
+  EXPECT_EQ(left.levels, (std::vector<size_t>{1, 2, 4}));
+  EXPECT_EQ(left.imbalance(), 1.0);
+
+  // справа ключи возрастают в порядке вставки — дерево вырождается в цепочку
+  b.erase_left(4);
+  auto right = b.shape_right();
+  EXPECT_EQ(right.height, 6);
+  EXPECT_EQ(right.max_depth(), 5);
+  EXPECT_EQ(b.height_right(), 6);
+  EXPECT_GT(right.imbalance(), 1.0);
+}
+
+TEST(bimap, three_way_comparator) {
+  using policy = counting_policy;
+  bimap<std::string, std::string, std::less<std::string>,
+        std::less<std::string>, policy>
+      b;
+  for (int i = 0; i < 100; i++) {
+    std::string key = std::to_string(i * 7919 % 100);
+    b.insert(key, key + "!");
+  }
+  b.reset_stats();
+  EXPECT_EQ(b.at_left("42"), "42!");
+  auto s = b.stats();
+  // по одному сравнению на вершину пути (корень-страж не сравнивается)
+  // и одно в find для проверки найденной вершины
+  EXPECT_EQ(s.left.comparisons, s.left.total_depth);
+
+  bimap<int, int, std::greater<>, three_way_int_compare> c;
+  c.insert(1, 3);
+  c.insert(2, 2);
+  c.insert(3, 1);
+  EXPECT_EQ(*c.begin_left(), 3);
+  EXPECT_EQ(*c.begin_right(), 1);
+  EXPECT_EQ(c.at_right(2), 2);
+  EXPECT_EQ(c.find_right(4), c.end_right());
+}
+
+struct inline_policy : intrusive_map::default_policy {
+  using stats = intrusive_map::counting_stats;
+  static constexpr std::size_t inline_capacity = 4;
+};
+
+TEST(bimap, inline_storage) {
+  using small_bimap = bimap<int, std::string, std::less<int>,
+                            std::less<std::string>, inline_policy>;
+  small_bimap b;
+  for (int i = 0; i < 4; i++) {
+    b.insert(i, std::to_string(i));
+  }
+  EXPECT_EQ(b.stats().nodes.allocations, 0);
+  b.insert(4, "4");
+  b.insert(5, "5");
+  EXPECT_EQ(b.stats().nodes.allocations, 2);
+  b.erase_left(1);
+  b.insert(6, "6");
+  EXPECT_EQ(b.stats().nodes.allocations, 2);
+  EXPECT_EQ(b.at_right("6"), 6);
+  EXPECT_EQ(b.find_left(5).flip(), b.find_right("5"));
+
+  small_bimap c(std::move(b));
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  b.insert(10, "10");
+  EXPECT_EQ(c.size(), 6);
+  EXPECT_EQ(c.at_left(3), "3");
+  EXPECT_EQ(c.at_right("4"), 4);
+  int prev = -1;
+  for (auto it = c.begin_left(); it != c.end_left(); ++it) {
+    EXPECT_GT(*it, prev);
+    prev = *it;
+  }
+
+  small_bimap d;
+  d.insert(100, "100");
+  d.swap(c);
+  EXPECT_EQ(c.size(), 1);
+  EXPECT_EQ(d.size(), 6);
+  EXPECT_EQ(c.at_left(100), "100");
+  EXPECT_EQ(d.at_right("0"), 0);
+
+  small_bimap e = d;
+  EXPECT_EQ(e, d);
+  c = std::move(d);
+  EXPECT_EQ(c, e);
+}
+
+struct prefix_policy : intrusive_map::default_policy {
+  using stats = intrusive_map::counting_stats;
+  using left_prefix = intrusive_map::string_prefix;
+  using right_prefix = intrusive_map::string_prefix;
+};
+
+TEST(bimap, key_prefix) {
+  static_assert(sizeof(intrusive_map::policy_bimap_node<int, int>) ==
+                sizeof(intrusive_map::bimap_node<int, int>));
+
+  bimap<std::string, std::string, std::less<std::string>,
+        std::less<std::string>, prefix_policy>
+      b;
+  std::map<std::string, std::string> expected;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 200; i++) {
+    // половина ключей различается уже в первых 8 байтах, половина — только в
+    // хвосте, чтобы проверить сравнение при равных префиксах
+    std::string key = (i % 2 ? "common_prefix_" : std::to_string(e()) + "_") +
+                      std::to_string(i);
+    std::string value = "value_" + std::to_string(e() % 1000) + key;
+    if (b.insert(key, value) != b.end_left()) {
+      expected[key] = value;
+    }
+  }
+  auto mit = expected.begin();
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++mit) {
+    EXPECT_EQ(*it, mit->first);
+    EXPECT_EQ(it.get_value(), mit->second);
+  }
+  EXPECT_EQ(mit, expected.end());
+
+  b.reset_stats();
+  std::string key = expected.begin()->first;
+  EXPECT_EQ(b.at_left(key), expected.begin()->second);
+  auto s = b.stats();
+  EXPECT_LT(s.left.comparisons, s.left.total_depth);
+
+  auto it = b.replace_left(b.find_right(expected.begin()->second), "zzz");
+  EXPECT_EQ(*it, "zzz");
+  EXPECT_EQ(b.at_left("zzz"), expected.begin()->second);
+  EXPECT_EQ(b.find_left(key), b.end_left());
+}
+
+TEST(bimap, sorted_unique_constructor) {
+  std::vector<std::pair<int, int>> data = {{1, 5}, {2, 3}, {3, 5}, {4, 1}};
+  bimap<int, int> b(intrusive_map::sorted_unique, data.begin(), data.end());
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.at_right(5), 1);
+  EXPECT_EQ(b.find_left(3), b.end_left());
+  EXPECT_EQ(b.at_left(4), 1);
+  EXPECT_EQ(b.height_left(), 2);
+  EXPECT_EQ(b.height_right(), 2);
+}
+
+TEST(bimap, set_algebra) {
+  using intrusive_map::conflict_policy;
+  bimap<int, std::string> a, b;
+  a.insert(1, "one");
+  a.insert(2, "two");
+  a.insert(3, "three");
+  b.insert(2, "two");
+  b.insert(3, "drei");
+  b.insert(4, "four");
+
+  auto u = merge_union(a, b);
+  EXPECT_EQ(u.size(), 4);
+  EXPECT_EQ(u.at_left(3), "three");
+  EXPECT_EQ(u.at_right("four"), 4);
+  EXPECT_EQ(merge_union(a, b, conflict_policy::take_second).at_left(3),
+            "drei");
+  EXPECT_EQ(merge_union(a, b, conflict_policy::drop).size(), 3);
+
+  auto i = intersect(a, b);
+  EXPECT_EQ(i.size(), 1);
+  EXPECT_EQ(i.at_left(2), "two");
+  EXPECT_EQ(intersect(a, b, conflict_policy::take_second).at_right("drei"), 3);
+
+  auto d = difference(a, b);
+  EXPECT_EQ(d.size(), 1);
+  EXPECT_EQ(d.at_left(1), "one");
+  EXPECT_EQ(difference(a, b, conflict_policy::take_first).size(), 2);
+
+  // одинаковый right у разных left: остается пара с меньшим left
+  bimap<int, std::string> c;
+  c.insert(5, "one");
+  EXPECT_EQ(merge_union(a, c).at_right("one"), 1);
+
+  auto changes = diff(a, b);
+  ASSERT_EQ(changes.added.size(), 1);
+  EXPECT_EQ(changes.added[0], std::make_pair(4, std::string("four")));
+  ASSERT_EQ(changes.removed.size(), 1);
+  EXPECT_EQ(changes.removed[0].first, 1);
+  ASSERT_EQ(changes.changed.size(), 1);
+  EXPECT_EQ(changes.changed[0].left, 3);
+  EXPECT_EQ(changes.changed[0].from, "three");
+  EXPECT_EQ(changes.changed[0].to, "drei");
+  EXPECT_TRUE(diff(a, a).empty());
+}
+
+TEST(bimap, compose) {
+  bimap<std::string, int> external_to_internal;
+  bimap<int, char> internal_to_shard;
+  external_to_internal.insert("ext-a", 10);
+  external_to_internal.insert("ext-b", 20);
+  external_to_internal.insert("ext-c", 30);
+  internal_to_shard.insert(30, 'x');
+  internal_to_shard.insert(10, 'z');
+  internal_to_shard.insert(40, 'y');
+
+  bimap<std::string, char> composed =
+      compose(external_to_internal, internal_to_shard);
+  EXPECT_EQ(composed.size(), 2);
+  EXPECT_EQ(composed.at_left("ext-a"), 'z');
+  EXPECT_EQ(composed.at_right('x'), "ext-c");
+  EXPECT_EQ(composed.find_left("ext-b"), composed.end_left());
+
+  auto view = compose_view(external_to_internal, internal_to_shard);
+  EXPECT_EQ(view.at_left("ext-c"), 'x');
+  EXPECT_EQ(view.at_right('z'), "ext-a");
+  EXPECT_THROW(view.at_left("ext-b"), std::out_of_range);
+  EXPECT_THROW(view.at_right('y'), std::out_of_range);
+
+  bimap<char, int> shard_to_port;
+  shard_to_port.insert('x', 8080);
+  auto chain = compose_view(view, shard_to_port);
+  EXPECT_EQ(chain.at_left("ext-c"), 8080);
+  EXPECT_EQ(chain.at_right(8080), "ext-c");
+}
+
+struct augment_policy : intrusive_map::default_policy {
+  using left_augment = intrusive_map::sum_augment<long long>;
+  using right_augment = intrusive_map::min_augment<int>;
+};
+
+TEST(bimap, range_aggregates) {
+  bimap<int, int, std::less<int>, std::less<int>, augment_policy> b;
+  std::map<int, int> left_view, right_view;
+  auto check = [&](int lo, int hi) {
+    long long sum = 0;
+    for (auto it = left_view.lower_bound(lo); it != left_view.end() &&
+                                              it->first < hi;
+         ++it) {
+      sum += it->second;
+    }
+    EXPECT_EQ(b.aggregate_left(lo, hi), sum);
+    int min = std::numeric_limits<int>::max();
+    for (auto it = right_view.lower_bound(lo); it != right_view.end() &&
+                                               it->first < hi;
+         ++it) {
+      min = std::min(min, it->second);
+    }
+    EXPECT_EQ(b.aggregate_right(lo, hi), min);
+  };
+
+  std::mt19937 e(seed);
+  for (int i = 0; i < 2000; i++) {
+    int l = static_cast<int>(e() % 1000), r = static_cast<int>(e() % 1000);
+    unsigned op = e() % 10;
+    if (op < 6) {
+      if (b.insert(l, r) != b.end_left()) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (op < 8) {
+      auto it = b.lower_bound_left(l);
+      if (it != b.end_left()) {
+        right_view.erase(it.get_value());
+        left_view.erase(*it);
+        b.erase_left(it);
+      }
+    } else {
+      auto it = b.lower_bound_left(l);
+      if (it != b.end_left() &&
+          b.replace_right(it, r) != b.end_right()) {
+        right_view.erase(left_view[*it]);
+        left_view[*it] = r;
+        right_view[r] = *it;
+      }
+    }
+    if (i % 50 == 0) {
+      int lo = static_cast<int>(e() % 1000);
+      check(lo, lo + static_cast<int>(e() % 300));
+      check(0, 1000);
+      check(lo, lo);
+    }
+  }
+
+  std::vector<std::pair<int, int>> sorted(left_view.begin(), left_view.end());
+  decltype(b) c(intrusive_map::sorted_unique, sorted.begin(), sorted.end());
+  EXPECT_EQ(c.aggregate_left(0, 1000), b.aggregate_left(0, 1000));
+  EXPECT_EQ(c.aggregate_right(100, 500), b.aggregate_right(100, 500));
+}
+
+struct finger_policy : intrusive_map::default_policy {
+  using stats = intrusive_map::counting_stats;
+  static constexpr bool remember_finger = true;
+};
+
+TEST(bimap, finger_search) {
+  bimap<int, int> b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(static_cast<int>(e() % 2000), static_cast<int>(e() % 2000));
+  }
+  for (int i = 0; i < 1000; i++) {
+    int key = static_cast<int>(e() % 2000);
+    auto finger = b.lower_bound_left(static_cast<int>(e() % 2000));
+    EXPECT_EQ(b.find_left_from(finger, key), b.find_left(key));
+    EXPECT_EQ(b.find_right_from(b.lower_bound_right(key / 2), key),
+              b.find_right(key));
+  }
+  EXPECT_EQ(b.find_left_from(b.end_left(), -1), b.end_left());
+
+  std::vector<std::pair<int, int>> data;
+  for (int i = 0; i < 1024; i++) {
+    data.emplace_back(i, -i);
+  }
+  bimap<int, int, std::less<int>, std::less<int>, finger_policy> f(
+      intrusive_map::sorted_unique, data.begin(), data.end());
+  for (int i = 0; i < 1024; i++) {
+    EXPECT_EQ(f.at_left(i), -i);
+  }
+  // последовательный проход: путь в среднем вдвое короче высоты дерева
+  EXPECT_LT(f.stats().left.average_depth(), f.height_left() / 2.0);
+
+  f.erase_left(1023);
+  EXPECT_EQ(f.find_left(1023), f.end_left());
+  EXPECT_EQ(f.at_left(1022), -1022);
+  auto g = std::move(f);
+  EXPECT_EQ(g.at_right(-5), 5);
+  EXPECT_EQ(g.at_left(7), -7);
+}
+
+struct cache_policy : intrusive_map::default_policy {
+  static constexpr std::size_t lookup_cache_size = 16;
+};
+
+TEST(bimap, lookup_cache) {
+  bimap<std::string, int, std::less<std::string>, std::less<int>,
+        cache_policy>
+      b;
+  for (int i = 0; i < 100; i++) {
+    b.insert("key" + std::to_string(i), i);
+  }
+  for (int round = 0; round < 10; round++) {
+    EXPECT_EQ(b.at_left("key7"), 7);
+    EXPECT_EQ(b.at_right(42), "key42");
+  }
+  EXPECT_EQ(b.cache_counters_left().misses, 1);
+  EXPECT_EQ(b.cache_counters_left().hits, 9);
+  EXPECT_EQ(b.cache_counters_right().hits, 9);
+
+  EXPECT_TRUE(b.erase_left("key7"));
+  EXPECT_EQ(b.find_left("key7"), b.end_left());
+  EXPECT_EQ(b.find_right(7), b.end_right());
+
+  b.replace_left(b.find_right(42), "answer");
+  EXPECT_EQ(b.find_left("key42"), b.end_left());
+  EXPECT_EQ(b.at_right(42), "answer");
+  b.replace_right(b.find_left("answer"), -42);
+  EXPECT_EQ(b.find_right(42), b.end_right());
+  EXPECT_EQ(b.at_left("answer"), -42);
+
+  auto c = std::move(b);
+  EXPECT_EQ(c.at_left("key8"), 8);
+  EXPECT_EQ(c.at_right(-42), "answer");
+}
+
+TEST(bimap, freeze) {
+  bimap<int, int, std::less<int>, std::greater<int>> b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(e() % 10000, e() % 10000);
+  }
+  auto f = b.freeze();
+  EXPECT_EQ(f.size(), b.size());
+
+  auto fit = f.begin_left();
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++fit) {
+    EXPECT_EQ(*fit, *it);
+    EXPECT_EQ(fit.get_value(), it.get_value());
+    EXPECT_EQ(fit.flip().flip(), fit);
+  }
+  EXPECT_EQ(fit, f.end_left());
+  auto frit = f.end_right();
+  for (auto it = b.end_right(); it != b.begin_right();) {
+    --it;
+    --frit;
+    EXPECT_EQ(*frit, *it);
+    EXPECT_EQ(*frit.flip(), *it.flip());
+  }
+  EXPECT_EQ(frit, f.begin_right());
+
+  for (int key = -1; key <= 10000; key++) {
+    auto it = b.lower_bound_left(key);
+    auto fl = f.lower_bound_left(key);
+    EXPECT_EQ(fl == f.end_left(), it == b.end_left());
+    if (it != b.end_left()) {
+      EXPECT_EQ(*fl, *it);
+    }
+    auto rit = b.upper_bound_right(key);
+    auto fr = f.upper_bound_right(key);
+    EXPECT_EQ(fr == f.end_right(), rit == b.end_right());
+    if (rit != b.end_right()) {
+      EXPECT_EQ(*fr, *rit);
+    }
+    EXPECT_EQ(f.find_left(key) == f.end_left(),
+              b.find_left(key) == b.end_left());
+  }
+  EXPECT_EQ(f.at_left(*b.begin_left()), b.begin_left().get_value());
+  EXPECT_THROW(f.at_right(-1), std::out_of_range);
+
+  bimap<int, int> empty;
+  auto g = empty.freeze();
+  EXPECT_TRUE(g.empty());
+  EXPECT_EQ(g.begin_left(), g.end_left());
+  EXPECT_EQ(g.find_right(0), g.end_right());
+}
+
+struct radix_policy : intrusive_map::default_policy {
+  using left_index = intrusive_map::radix_index;
+  using right_index = intrusive_map::radix_index;
+  static constexpr std::size_t inline_capacity = 8;
+};
+
+TEST(bimap, radix_index) {
+  bimap<std::string, long long, std::less<std::string>, std::less<long long>,
+        radix_policy>
+      b;
+  std::map<std::string, long long> left_view;
+  std::map<long long, std::string> right_view;
+  std::vector<std::string> words = {"", "a", "ab", "abc", "abd", "b",
+                                    "http://x", "http://x/y", "\xff"};
+  std::mt19937 e(seed);
+  for (int i = 0; i < 3000; i++) {
+    std::string l = words[e() % words.size()] + std::to_string(e() % 300);
+    long long r = static_cast<long long>(e() % 2000) - 1000;
+    if (e() % 4 == 0) {
+      b.erase_left(l);
+      auto it = left_view.find(l);
+      if (it != left_view.end()) {
+        right_view.erase(it->second);
+        left_view.erase(it);
+      }
+    } else if (b.insert(l, r) != b.end_left()) {
+      left_view.emplace(l, r);
+      right_view.emplace(r, l);
+    }
+  }
+  b.replace_right(b.begin_left(), 5000);
+  right_view.erase(left_view.begin()->second);
+  left_view.begin()->second = 5000;
+  right_view.emplace(5000, left_view.begin()->first);
+
+  auto c = std::move(b);
+  ASSERT_EQ(c.size(), left_view.size());
+  // Вставка вешает вершины по индексу, деревья должны остаться в порядке
+  auto left_it = c.begin_left();
+  for (auto const& [l, r] : left_view) {
+    ASSERT_EQ(*left_it++, l);
+  }
+  auto right_it = c.begin_right();
+  for (auto const& [r, l] : right_view) {
+    ASSERT_EQ(*right_it++, r);
+  }
+  for (auto const& word : words) {
+    for (int i = 0; i < 300; i += 7) {
+      std::string key = word + std::to_string(i);
+      auto lb = left_view.lower_bound(key);
+      auto it = c.lower_bound_left(key);
+      ASSERT_EQ(it == c.end_left(), lb == left_view.end());
+      if (lb != left_view.end()) {
+        EXPECT_EQ(*it, lb->first);
+        EXPECT_EQ(it.get_value(), lb->second);
+      }
+      auto ub = left_view.upper_bound(word);
+      auto uit = c.upper_bound_left(word);
+      ASSERT_EQ(uit == c.end_left(), ub == left_view.end());
+      if (ub != left_view.end()) {
+        EXPECT_EQ(*uit, ub->first);
+      }
+      EXPECT_EQ(c.find_left(key) == c.end_left(), !left_view.count(key));
+    }
+  }
+  for (long long r = -1001; r <= 1001; r++) {
+    auto lb = right_view.lower_bound(r);
+    auto it = c.lower_bound_right(r);
+    ASSERT_EQ(it == c.end_right(), lb == right_view.end());
+    if (lb != right_view.end()) {
+      EXPECT_EQ(*it, lb->first);
+      EXPECT_EQ(*it.flip(), lb->second);
+    }
+    auto ub = right_view.upper_bound(r);
+    auto uit = c.upper_bound_right(r);
+    ASSERT_EQ(uit == c.end_right(), ub == right_view.end());
+    if (ub != right_view.end()) {
+      EXPECT_EQ(*uit, ub->first);
+    }
+  }
+  EXPECT_EQ(c.at_right(5000), left_view.begin()->first);
+}
+
+struct radix_stats_policy : radix_policy {
+  using stats = intrusive_map::counting_stats;
+};
+
+TEST(bimap, radix_index_insert_without_comparisons) {
+  bimap<std::string, long long, std::less<std::string>, std::less<long long>,
+        radix_stats_policy>
+      b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 500; i++) {
+    b.insert(std::to_string(e() % 1000), static_cast<long long>(e() % 1000));
+  }
+  std::string first = *b.begin_left();
+  b.erase_left(first);
+  EXPECT_EQ(b.stats().left.comparisons, 0);
+  EXPECT_EQ(b.stats().right.comparisons, 0);
+  EXPECT_EQ(b.stats().left.searches, 0);
+  std::string prev;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    EXPECT_LT(prev, *it);
+    prev = *it;
+  }
+  long long prev_right = -1;
+  for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+    EXPECT_LT(prev_right, *it);
+    prev_right = *it;
+  }
+}
+
+TEST(bimap, radix_index_replace_keys) {
+  bimap<int, std::string, std::less<int>, std::less<std::string>,
+        radix_policy>
+      b;
+  std::map<int, std::string> view;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 200; i++) {
+    int l = static_cast<int>(e() % 400);
+    if (b.insert(l, std::to_string(l)) != b.end_left()) {
+      view.emplace(l, std::to_string(l));
+    }
+  }
+  for (int i = 0; i < 2000; i++) {
+    auto pos = view.begin();
+    std::advance(pos, e() % view.size());
+    if (e() % 2) {
+      int l = static_cast<int>(e() % 400);
+      bool free = !view.count(l) || l == pos->first;
+      auto it = b.replace_left(b.find_right(pos->second), l);
+      ASSERT_EQ(it != b.end_left(), free);
+      if (free) {
+        std::string r = pos->second;
+        view.erase(pos);
+        view.emplace(l, r);
+      }
+    } else {
+      std::string r = "r" + std::to_string(e() % 400);
+      auto it = b.replace_right(b.find_left(pos->first), r);
+      if (it != b.end_right()) {
+        pos->second = r;
+      }
+    }
+  }
+  ASSERT_EQ(b.size(), view.size());
+  auto it = b.begin_left();
+  for (auto const& [l, r] : view) {
+    ASSERT_EQ(*it, l);
+    EXPECT_EQ(it.get_value(), r);
+    EXPECT_EQ(b.find_left(l), it);
+    EXPECT_EQ(b.find_right(r).flip(), it);
+    ++it;
+  }
+}
+
+struct dense_policy : intrusive_map::default_policy {
+  using left_index = intrusive_map::dense_index<0, 16>;
+};
+
+TEST(bimap, dense_index) {
+  bimap<int, std::string, std::less<int>, std::less<std::string>,
+        dense_policy>
+      b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, "id" + std::to_string(i));
+  }
+  b.insert(-5, "negative");
+  b.insert(1000, "far");
+  EXPECT_EQ(b.at_left(42), "id42");
+  EXPECT_EQ(b.at_left(-5), "negative");
+  EXPECT_EQ(b.at_left(1000), "far");
+  EXPECT_EQ(b.find_left(500), b.end_left());
+  EXPECT_EQ(b.find_left(-100), b.end_left());
+  EXPECT_EQ(*b.begin_left(), -5);
+  EXPECT_EQ(*b.lower_bound_left(101), 1000);
+
+  EXPECT_TRUE(b.erase_left(42));
+  EXPECT_FALSE(b.erase_left(42));
+  EXPECT_EQ(b.find_right("id42"), b.end_right());
+  b.replace_left(b.find_right("id7"), 42);
+  EXPECT_EQ(b.find_left(7), b.end_left());
+  EXPECT_EQ(b.at_left(42), "id7");
+
+  bimap<int, std::string, std::less<int>, std::less<std::string>,
+        dense_policy>
+      c;
+  c.insert(3, "three");
+  c.swap(b);
+  EXPECT_EQ(c.at_left(1000), "far");
+  EXPECT_EQ(b.at_left(3), "three");
+  EXPECT_EQ(b.find_left(1000), b.end_left());
+
+  int prev = -6;
+  for (auto it = c.begin_left(); it != c.end_left(); ++it) {
+    EXPECT_LT(prev, *it);
+    EXPECT_EQ(c.find_left(*it), it);
+    prev = *it;
+  }
+}
+
+TEST(bimap, dense_index_replace_with_throwing_compare) {
+  bimap<int, int, unlucky_compare, std::less<int>, dense_policy> b;
+  for (int i = 0; i < 10; i++) {
+    b.insert(i, i);
+  }
+  EXPECT_THROW(b.replace_left(b.find_right(5), 13), std::runtime_error);
+  EXPECT_EQ(b.at_left(5), 5);
+  EXPECT_EQ(b.at_right(5), 5);
+  auto it = b.replace_left(b.find_right(5), 20);
+  EXPECT_EQ(it, b.find_left(20));
+  EXPECT_EQ(b.find_left(5), b.end_left());
+  EXPECT_EQ(b.size(), 10);
+}
+
+TEST(bimap, dense_index_sorted_unique) {
+  using map_t =
+      bimap<int, int, std::less<int>, unlucky_compare, dense_policy>;
+  std::vector<std::pair<int, int>> data = {{1, 5}, {2, 3}, {3, 5}, {20, 1}};
+  map_t b(intrusive_map::sorted_unique, data.begin(), data.end());
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.at_left(1), 5);
+  EXPECT_EQ(b.find_left(3), b.end_left());
+  EXPECT_EQ(b.at_left(20), 1);
+  b.insert(3, 7);
+  EXPECT_EQ(b.at_right(7), 3);
+
+  // сравнение правых ключей бросает до того, как вершины попадут в индекс
+  data.emplace_back(30, 13);
+  EXPECT_THROW(map_t(intrusive_map::sorted_unique, data.begin(), data.end()),
+               std::runtime_error);
+}
+
+TEST(bimap, dense_index_outliers) {
+  bimap<long long, int, std::less<long long>, std::less<int>, dense_policy> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, i);
+  }
+  // Массив не растягивается до выброса, выброс ищется по дереву
+  b.insert(1'000'000'000'000LL, -1);
+  b.insert(-1'000'000'000'000LL, -2);
+  EXPECT_EQ(b.at_left(1'000'000'000'000LL), -1);
+  EXPECT_EQ(b.at_left(-1'000'000'000'000LL), -2);
+  EXPECT_EQ(b.find_left(999'999'999'999LL), b.end_left());
+  // Пока выбросы в дереве, ключи вне массива тоже остаются в дереве
+  b.insert(150, 150);
+  EXPECT_EQ(b.at_left(150), 150);
+  EXPECT_EQ(b.find_left(149), b.end_left());
+  b.erase_left(1'000'000'000'000LL);
+  b.erase_left(-1'000'000'000'000LL);
+  b.erase_left(150);
+  for (int i = 100; i < 300; i++) {
+    b.insert(i, i);
+  }
+  for (long long i = -10; i < 310; i++) {
+    auto it = b.find_left(i);
+    ASSERT_EQ(it != b.end_left(), i >= 0 && i < 300);
+    if (it != b.end_left()) {
+      EXPECT_EQ(it.get_value(), i);
+    }
+  }
+  EXPECT_EQ(b.size(), 300);
+}
+
+struct lru_policy : intrusive_map::default_policy {
+  static constexpr std::size_t lru_capacity = 3;
+  static constexpr std::size_t inline_capacity = 2;
+};
+
+TEST(bimap, lru_eviction) {
+  using lru_bimap =
+      bimap<int, int, std::less<int>, std::less<int>, lru_policy>;
+  lru_bimap b;
+  std::vector<int> evicted;
+  b.on_evict([&](int const& left, int const& right) {
+    EXPECT_EQ(right, left * 10);
+    evicted.push_back(left);
+  });
+  for (int i = 1; i <= 3; i++) {
+    b.insert(i, i * 10);
+  }
+  EXPECT_NE(b.find_left(1), b.end_left());
+  EXPECT_EQ(b.insert(1, 100), b.end_left());
+  EXPECT_TRUE(evicted.empty());
+
+  b.insert(4, 40);
+  EXPECT_EQ(evicted, std::vector<int>{2});
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.find_right(20), b.end_right());
+  EXPECT_EQ(b.at_right(30), 3);
+  b.insert(5, 50);
+  EXPECT_EQ(evicted, (std::vector<int>{2, 1}));
+
+  lru_bimap c = b;
+  c.insert(6, 60);
+  EXPECT_EQ(evicted, (std::vector<int>{2, 1, 4}));
+  EXPECT_NE(b.find_left(4), b.end_left());
+
+  lru_bimap d = std::move(b);
+  d.insert(7, 70);
+  EXPECT_EQ(evicted, (std::vector<int>{2, 1, 4, 3}));
+  d.erase_left(5);
+  d.insert(8, 80);
+  d.insert(9, 90);
+  EXPECT_EQ(evicted, (std::vector<int>{2, 1, 4, 3, 4}));
+  d.swap(c);
+  c.insert(10, 100);
+  EXPECT_EQ(evicted, (std::vector<int>{2, 1, 4, 3, 4, 7}));
+  EXPECT_EQ(lru_bimap::capacity(), 3);
+}
+
+struct small_lru_policy : intrusive_map::default_policy {
+  static constexpr std::size_t lru_capacity = 2;
+};
+
+TEST(bimap, lru_failed_insert_keeps_pairs) {
+  bimap<throwing_copy, int, std::less<throwing_copy>, std::less<int>,
+        small_lru_policy>
+      b;
+  b.insert(throwing_copy(1), 1);
+  b.insert(throwing_copy(2), 2);
+  int evicted = 0;
+  b.on_evict([&](throwing_copy const&, int) { evicted++; });
+  throwing_copy key(3);
+  throwing_copy::fail = true;
+  EXPECT_THROW(b.insert(key, 3), std::runtime_error);
+  throwing_copy::fail = false;
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(evicted, 0);
+  EXPECT_EQ(b.at_left(throwing_copy(1)), 1);
+  EXPECT_EQ(b.at_left(throwing_copy(2)), 2);
+  EXPECT_EQ(b.find_right(3), b.end_right());
+
+  b.insert(key, 3);
+  EXPECT_EQ(evicted, 1);
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.find_left(throwing_copy(1)), b.end_left());
+}
+
+TEST(bimap, concurrent_flat_combining) {
+  concurrent_bimap<int, int> b;
+  constexpr int threads = 8;
+  constexpr int per_thread = 2000;
+  std::vector<std::thread> workers;
+  std::atomic<int> failures{0};
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&b, &failures, t] {
+      int base = t * per_thread;
+      for (int i = 0; i < per_thread; i++) {
+        if (!b.insert(base + i, -(base + i)) || b.insert(base + i, 1 << 30)) {
+          failures++;
+        }
+      }
+      for (int i = 0; i < per_thread; i += 2) {
+        if (!b.erase_left(base + i) || b.find_left(base + i)) {
+          failures++;
+        }
+        if (b.find_right(-(base + i + 1)) != base + i + 1) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (std::thread& w : workers) {
+    w.join();
+  }
+  EXPECT_EQ(failures, 0);
+  EXPECT_EQ(b.size(), threads * per_thread / 2);
+  EXPECT_LE(b.batches(), b.combined());
+  b.with_locked([](auto const& m) {
+    for (auto it = m.begin_left(); it != m.end_left(); ++it) {
+      EXPECT_EQ(*it % 2, 1);
+      EXPECT_EQ(it.get_value(), -*it);
+    }
+  });
+}
+
+TEST(bimap, concurrent_exception_reaches_owner) {
+  concurrent_bimap<int, int, unlucky_compare> b;
+  constexpr int threads = 4;
+  constexpr int per_thread = 500;
+  std::vector<std::thread> workers;
+  std::atomic<int> thrown{0};
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&b, &thrown, t] {
+      for (int i = 0; i < per_thread; i++) {
+        int key = 100 + t * per_thread + i;
+        b.insert(key, key);
+        try {
+          b.insert(13, -t * per_thread - i);
+        } catch (std::runtime_error const&) {
+          thrown++;
+        }
+      }
+    });
+  }
+  for (std::thread& w : workers) {
+    w.join();
+  }
+  EXPECT_EQ(thrown, threads * per_thread);
+  EXPECT_EQ(b.size(), threads * per_thread);
+  EXPECT_EQ(b.find_left(100), 100);
+}
+
+struct journal_policy : intrusive_map::default_policy {
+  static constexpr bool journal = true;
+};
+
+TEST(bimap, journal_replay) {
+  using journaled =
+      bimap<int, std::string, std::less<int>, std::less<std::string>,
+            journal_policy>;
+  journaled b;
+  std::string log;
+  std::size_t records = 0;
+  b.journal_to([&](std::string_view record) {
+    log.append(record);
+    records++;
+  });
+  b.insert(1, "one");
+  b.insert(-300, "minus");
+  b.insert(2, "one");
+  journaled snapshot = b;
+  std::size_t snapshot_records = records;
+  std::size_t snapshot_size = log.size();
+
+  b.insert(7, "seven");
+  b.erase_left(1);
+  b.erase_right("minus");
+  b.replace_right(b.find_left(7), "SEVEN");
+  b.replace_left(b.find_right("SEVEN"), 70);
+  b.at_right_or_default("x");
+  b.at_left_or_default(100);
+  b.at_left_or_default(5);
+  EXPECT_EQ(b.at_left(5), "");
+  EXPECT_EQ(b.find_left(100), b.end_left());
+  EXPECT_EQ(b.at_right("x"), 0);
+  EXPECT_EQ(b.at_left(70), "SEVEN");
+
+  EXPECT_EQ(intrusive_map::replay(
+                snapshot, std::string_view(log).substr(snapshot_size)),
+            records - snapshot_records);
+  EXPECT_EQ(snapshot, b);
+
+  journaled replica;
+  intrusive_map::replay(replica, log);
+  EXPECT_EQ(replica, b);
+  EXPECT_THROW(intrusive_map::replay(replica, log.substr(0, 3)),
+               std::invalid_argument);
+}
+
+TEST(bimap, journal_follows_whole_content_changes) {
+  using journaled =
+      bimap<int, std::string, std::less<int>, std::less<std::string>,
+            journal_policy>;
+  journaled b;
+  std::string log;
+  b.journal_to([&](std::string_view record) { log.append(record); });
+  journaled other;
+  std::string other_log;
+  other.journal_to([&](std::string_view record) { other_log.append(record); });
+  auto in_sync = [&] {
+    journaled replica;
+    intrusive_map::replay(replica, log);
+    journaled other_replica;
+    intrusive_map::replay(other_replica, other_log);
+    return replica == b && other_replica == other;
+  };
+
+  b.insert(1, "one");
+  other.insert(2, "two");
+  other.insert(3, "three");
+  journaled plain;
+  plain.insert(4, "four");
+
+  // Копия приходит без sink, а присваивание не отбирает sink у b
+  b = plain;
+  EXPECT_TRUE(in_sync());
+  b.insert(5, "five");
+  EXPECT_TRUE(in_sync());
+  b.swap(other);
+  EXPECT_TRUE(in_sync());
+  b.insert(6, "six");
+  other.insert(7, "seven");
+  EXPECT_TRUE(in_sync());
+  b = std::move(other);
+  EXPECT_TRUE(other.empty());
+  EXPECT_TRUE(in_sync());
+  other.insert(8, "eight");
+  EXPECT_TRUE(in_sync());
+  b.clear();
+  b.insert(9, "nine");
+  EXPECT_TRUE(in_sync());
+
+  // plain не журналируется, в том числе после присваивания от b
+  std::size_t before = log.size();
+  plain = b;
+  plain.insert(10, "ten");
+  EXPECT_EQ(log.size(), before);
+}
+
+struct fingerprint_policy : intrusive_map::default_policy {
+  static constexpr bool track_fingerprint = true;
+};
+
+TEST(bimap, fingerprint) {
+  using fp_bimap = bimap<int, std::string, std::less<int>,
+                         std::less<std::string>, fingerprint_policy>;
+  fp_bimap a, b;
+  for (int i = 0; i < 100; i++) {
+    a.insert(i, std::to_string(i));
+    b.insert(99 - i, std::to_string(99 - i));
+  }
+  EXPECT_EQ(a.fingerprint(), b.fingerprint());
+  EXPECT_EQ(a, b);
+
+  b.replace_right(b.find_left(5), "five");
+  EXPECT_NE(a.fingerprint(), b.fingerprint());
+  EXPECT_NE(a, b);
+  b.replace_left(b.find_right("five"), 500);
+  b.replace_left(b.find_right("five"), 5);
+  b.replace_right(b.find_left(5), "5");
+  EXPECT_EQ(a.fingerprint(), b.fingerprint());
+  EXPECT_EQ(a, b);
+
+  fp_bimap swapped;
+  swapped.insert(5, "4");
+  swapped.insert(4, "5");
+  fp_bimap straight;
+  straight.insert(4, "4");
+  straight.insert(5, "5");
+  EXPECT_NE(swapped.fingerprint(), straight.fingerprint());
+
+  fp_bimap c = std::move(b);
+  EXPECT_EQ(c.fingerprint(), a.fingerprint());
+  EXPECT_EQ(b.fingerprint(), intrusive_map::content_fingerprint());
+  c.erase_left(c.begin_left(), c.end_left());
+  EXPECT_EQ(c.fingerprint(), intrusive_map::content_fingerprint());
+}
+
+TEST(bimap, erase_if) {
+  bimap<int, int, std::less<int>, std::greater<int>> b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, static_cast<int>(e() % 100000));
+  }
+  std::size_t size = b.size();
+  EXPECT_EQ(erase_if(b, [](int left, int) { return left == 500; }), 1);
+  EXPECT_EQ(b.find_left(500), b.end_left());
+
+  auto kept = b.find_left(501);
+  std::size_t removed =
+      erase_if(b, [](int left, int right) { return (left + right) % 3 == 0; });
+  EXPECT_GT(removed, size / 8);
+  EXPECT_EQ(b.size() + removed + 1, size);
+  int count = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++count) {
+    EXPECT_NE((*it + it.get_value()) % 3, 0);
+    EXPECT_EQ(b.find_right(it.get_value()), it.flip());
+  }
+  EXPECT_EQ(count, b.size());
+  int prev = std::numeric_limits<int>::max();
+  for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+    EXPECT_LT(*it, prev);
+    prev = *it;
+  }
+  if ((501 + kept.get_value()) % 3 != 0) {
+    EXPECT_EQ(b.find_left(501), kept);
+  }
+  EXPECT_LE(b.height_left(), 10);
+
+  size = b.size();
+  EXPECT_EQ(erase_if(b, [](int, int) { return true; }), size);
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_right(), b.end_right());
+}
+
+namespace {
+using int_changeset = intrusive_map::changeset<int, int>;
+
+// Применяет пачку к модели так, как ее описывает intrusive_map::changeset
+void apply_to_model(std::map<int, int>& model, int_changeset const& changes) {
+  std::map<int, std::optional<int>> last;
+  for (auto const& e : changes.entries()) {
+    last.insert_or_assign(e.left, e.right);
+  }
+  for (auto const& [left, right] : last) {
+    model.erase(left);
+  }
+  for (auto const& [left, right] : last) {
+    if (right) {
+      std::erase_if(model, [&](auto const& p) { return p.second == *right; });
+      model[left] = *right;
+    }
+  }
+}
+
+template <typename Bimap>
+void expect_same(Bimap const& b, std::map<int, int> const& model) {
+  ASSERT_EQ(b.size(), model.size());
+  auto it = b.begin_left();
+  for (auto const& [left, right] : model) {
+    EXPECT_EQ(*it, left);
+    EXPECT_EQ(it.get_value(), right);
+    EXPECT_EQ(b.find_left(left), it);
+    EXPECT_EQ(b.find_right(right), it.flip());
+    ++it;
+  }
+  std::size_t count = 0;
+  for (auto r = b.begin_right(); r != b.end_right(); ++r, ++count) {
+    EXPECT_EQ(model.at(r.get_value()), *r);
+  }
+  EXPECT_EQ(count, model.size());
+}
+} // namespace
+
+TEST(bimap, apply_changeset) {
+  std::mt19937 e(seed);
+  bimap<int, int, std::less<int>, std::less<int>, fingerprint_policy> b;
+  std::map<int, int> model;
+  for (std::size_t batch : {2000, 10, 500, 3}) {
+    std::vector<int> rights(4000);
+    std::iota(rights.begin(), rights.end(), 0);
+    std::shuffle(rights.begin(), rights.end(), e);
+    int_changeset changes;
+    for (std::size_t i = 0; i < batch; i++) {
+      int left = static_cast<int>(e() % 3000);
+      if (e() % 4 == 0) {
+        changes.erase(left);
+      } else {
+        changes.upsert(left, rights[i]);
+      }
+    }
+    apply_to_model(model, changes);
+    b.apply(std::move(changes));
+    expect_same(b, model);
+  }
+
+  decltype(b) rebuilt;
+  for (auto const& [left, right] : model) {
+    rebuilt.insert(left, right);
+  }
+  EXPECT_EQ(b.fingerprint(), rebuilt.fingerprint());
+  EXPECT_EQ(b, rebuilt);
+}
+
+struct apply_index_policy : intrusive_map::default_policy {
+  using left_index = intrusive_map::radix_index;
+  using right_index = intrusive_map::dense_index<0, 64>;
+};
+
+// Пары, у которых upsert забирает ключ, передают свои записи индексов
+TEST(bimap, apply_changeset_with_indices) {
+  std::mt19937 e(seed);
+  bimap<int, int, std::less<int>, std::less<int>, apply_index_policy> b;
+  std::map<int, int> model;
+  for (std::size_t batch : {2000, 1000, 700, 500}) {
+    std::vector<int> rights(4000);
+    std::iota(rights.begin(), rights.end(), 0);
+    std::shuffle(rights.begin(), rights.end(), e);
+    int_changeset changes;
+    for (std::size_t i = 0; i < batch; i++) {
+      int left = static_cast<int>(e() % 3000);
+      if (e() % 4 == 0) {
+        changes.erase(left);
+      } else {
+        changes.upsert(left, rights[i]);
+      }
+    }
+    apply_to_model(model, changes);
+    b.apply(std::move(changes));
+    expect_same(b, model);
+    for (int left = 0; left < 3000; left++) {
+      EXPECT_EQ(b.find_left(left) != b.end_left(), model.count(left) != 0);
+    }
+  }
+}
+
+TEST(bimap, apply_changeset_swap_and_conflict) {
+  for (std::size_t size : {4, 100}) {
+    bimap<int, int> b;
+    std::map<int, int> model;
+    for (int i = 0; i < static_cast<int>(size); i++) {
+      b.insert(i, i * 10);
+      model[i] = i * 10;
+    }
+    auto kept = b.find_left(3);
+    int_changeset changes;
+    changes.upsert(1, 20);
+    changes.upsert(2, 10);
+    changes.upsert(3, 30);
+    changes.upsert(5, 1);
+    changes.erase(5);
+    changes.upsert(1000, 0);
+    apply_to_model(model, changes);
+    b.apply(std::move(changes));
+    expect_same(b, model);
+    EXPECT_EQ(b.find_left(3), kept);
+    EXPECT_EQ(b.find_left(0), b.end_left());
+
+    int_changeset conflict;
+    conflict.upsert(1, 7);
+    conflict.upsert(2, 7);
+    EXPECT_THROW(b.apply(std::move(conflict)), std::invalid_argument);
+    expect_same(b, model);
+  }
+}
+
+TEST(bimap, trace_recorder) {
+  using intrusive_map::trace_op;
+  std::ostringstream out;
+  {
+    traced_bimap<int, std::string> b(out);
+    b.insert(1, "a");
+    b.insert(-2, "b");
+    EXPECT_EQ(b.at_left(1), "a");
+    EXPECT_EQ(b.find_right("b"), b.underlying().find_right("b"));
+    EXPECT_EQ(b.scan_left(-5, 10, [](int, std::string const&) {}), 2);
+    EXPECT_TRUE(b.erase_left(1));
+    EXPECT_EQ(b.size(), 1);
+  }
+  std::string data = out.str();
+  std::string_view in = data;
+  intrusive_map::trace_header header = intrusive_map::read_trace_header(in);
+  EXPECT_EQ(header.keys, intrusive_map::trace_keys::raw);
+  EXPECT_EQ(header.left_tag, 'i');
+  EXPECT_EQ(header.right_tag, 's');
+  std::vector<intrusive_map::trace_record<std::int64_t, std::string>> recs;
+  intrusive_map::trace_record<std::int64_t, std::string> rec;
+  while (intrusive_map::read_trace_record(in, rec)) {
+    recs.push_back(rec);
+  }
+  ASSERT_EQ(recs.size(), 6);
+  EXPECT_EQ(recs[1].op, trace_op::insert);
+  EXPECT_EQ(recs[1].left, -2);
+  EXPECT_EQ(recs[1].right, "b");
+  EXPECT_EQ(recs[2].op, trace_op::at_left);
+  EXPECT_EQ(recs[3].op, trace_op::find_right);
+  EXPECT_EQ(recs[3].right, "b");
+  EXPECT_EQ(recs[4].op, trace_op::scan_left);
+  EXPECT_EQ(recs[4].left, -5);
+  EXPECT_EQ(recs[4].steps, 10);
+  EXPECT_EQ(recs[5].op, trace_op::erase_left);
+
+  std::ostringstream hashed_out;
+  traced_bimap<int, std::string> hashed(hashed_out,
+                                        intrusive_map::trace_keys::hashed);
+  hashed.insert(7, "x");
+  data = hashed_out.str();
+  in = data;
+  header = intrusive_map::read_trace_header(in);
+  EXPECT_EQ(header.left_tag, 'h');
+  EXPECT_EQ(header.right_tag, 'h');
+  intrusive_map::trace_record<std::uint64_t, std::uint64_t> hashed_rec;
+  ASSERT_TRUE(intrusive_map::read_trace_record(in, hashed_rec));
+  EXPECT_EQ(hashed_rec.left, std::hash<int>()(7));
+  EXPECT_EQ(hashed_rec.right, std::hash<std::string>()("x"));
+  EXPECT_FALSE(intrusive_map::read_trace_record(in, hashed_rec));
+}
+
+struct compact_policy : intrusive_map::default_policy {
+  using stats = intrusive_map::counting_stats;
+  static constexpr std::size_t inline_capacity = 4;
+  static constexpr std::size_t lru_capacity = 1000;
+  static constexpr bool compactable = true;
+};
+
+TEST(bimap, compact) {
+  bimap<int, std::string, std::less<int>, std::less<std::string>,
+        compact_policy>
+      b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 300; i++) {
+    b.insert(static_cast<int>(e() % 1000), std::to_string(i));
+  }
+  for (int i = 0; i < 100; i++) {
+    b.erase_left(static_cast<int>(e() % 1000));
+  }
+  std::vector<std::pair<int, std::string>> before;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    before.emplace_back(*it, it.get_value());
+  }
+  b.compact();
+  std::vector<std::pair<int, std::string>> after;
+  char const* prev = nullptr;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    after.emplace_back(*it, it.get_value());
+    EXPECT_EQ(b.find_right(it.get_value()), it.flip());
+    auto const* addr = reinterpret_cast<char const*>(&*it);
+    if (prev) {
+      EXPECT_EQ(addr - prev,
+                sizeof(intrusive_map::policy_bimap_node<int, std::string,
+                                                        compact_policy>));
+    }
+    prev = addr;
+  }
+  EXPECT_EQ(before, after);
+
+  b.find_left(before[0].first);
+  b.compact<intrusive_map::right_tag>();
+  prev = nullptr;
+  for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+    auto const* addr = reinterpret_cast<char const*>(&it.get_value());
+    if (prev) {
+      EXPECT_GT(addr, prev);
+    }
+    prev = addr;
+  }
+  auto stats = b.stats();
+  EXPECT_EQ(stats.nodes.allocations - stats.nodes.frees, 1);
+
+  // Вершины из блока и новые вершины удаляются как обычно, свежесть пар
+  // переезжает вместе с вершинами
+  b.insert(-1, "new");
+  b.erase_left(before[1].first);
+  std::size_t size = b.size();
+  std::vector<int> evicted;
+  b.on_evict([&](int left, std::string const&) { evicted.push_back(left); });
+  for (int i = 0; i < 1000; i++) {
+    b.insert(2000 + i, std::string("x").append(std::to_string(i)));
+  }
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(evicted.size(), size);
+  ASSERT_GE(evicted.size(), 2);
+  EXPECT_EQ(evicted[evicted.size() - 2], before[0].first);
+  EXPECT_EQ(evicted.back(), -1);
+}
+
+namespace {
+struct account {
+  int id;
+  std::string name;
+  std::string ref;
+  int group;
+};
+struct by_id {};
+struct by_name {};
+struct by_ref {};
+struct by_group {};
+
+using accounts =
+    multi_index<account, intrusive_map::index_by<by_id, &account::id>,
+                intrusive_map::index_by<by_name, &account::name>,
+                intrusive_map::index_by<by_ref, &account::ref,
+                                        std::greater<>>,
+                intrusive_map::non_unique_index_by<by_group, &account::group>>;
+
+template <typename Tag>
+std::vector<int> ids(accounts const& a) {
+  std::vector<int> res;
+  for (account const& rec : a.range<Tag>()) {
+    res.push_back(rec.id);
+  }
+  return res;
+}
+} // namespace
+
+TEST(multi_index, three_keys) {
+  accounts a;
+  EXPECT_NE(a.insert({3, "carol", "r1", 1}), a.end<by_id>());
+  EXPECT_NE(a.insert({1, "alice", "r3", 2}), a.end<by_id>());
+  EXPECT_NE(a.insert({2, "bob", "r2", 1}), a.end<by_id>());
+  // Конфликт в любом уникальном индексе — записи нет ни в одном
+  EXPECT_EQ(a.insert({4, "bob", "r4", 1}), a.end<by_id>());
+  EXPECT_EQ(a.insert({1, "dave", "r5", 1}), a.end<by_id>());
+  EXPECT_EQ(a.emplace(account{5, "eve", "r2", 3}), a.end<by_id>());
+  EXPECT_EQ(a.size(), 3);
+  EXPECT_EQ(a.find<by_id>(4), a.end<by_id>());
+
+  EXPECT_EQ(ids<by_id>(a), (std::vector<int>{1, 2, 3}));
+  EXPECT_EQ(ids<by_name>(a), (std::vector<int>{1, 2, 3}));
+  EXPECT_EQ(ids<by_ref>(a), (std::vector<int>{1, 2, 3}));
+  EXPECT_EQ(ids<by_group>(a), (std::vector<int>{3, 2, 1}));
+
+  EXPECT_EQ(a.find<by_name>("bob")->ref, "r2");
+  EXPECT_EQ(a.find<by_ref>(std::string("r3"))->name, "alice");
+  EXPECT_EQ(a.count<by_group>(1), 2);
+  EXPECT_EQ(a.find<by_group>(1)->id, 3);
+  EXPECT_EQ(a.lower_bound<by_name>("b")->id, 2);
+  EXPECT_EQ(a.upper_bound<by_name>("bob")->id, 3);
+  auto it = a.find<by_name>("carol");
+  EXPECT_EQ(a.project<by_id>(it), a.find<by_id>(3));
+  EXPECT_EQ(a.project<by_ref>(a.end<by_name>()), a.end<by_ref>());
+
+  accounts copy = a;
+  a.erase(a.find<by_ref>(std::string("r2")));
+  EXPECT_EQ(a.find<by_name>("bob"), a.end<by_name>());
+  EXPECT_EQ(a.count<by_group>(1), 1);
+  EXPECT_EQ(ids<by_id>(a), (std::vector<int>{1, 3}));
+  EXPECT_EQ(a.erase<by_group>(1), 1);
+  EXPECT_EQ(ids<by_name>(a), (std::vector<int>{1}));
+  EXPECT_NE(a.insert({2, "bob", "r2", 1}), a.end<by_id>());
+
+  EXPECT_EQ(copy.size(), 3);
+  EXPECT_EQ(ids<by_ref>(copy), (std::vector<int>{1, 2, 3}));
+  accounts moved = std::move(copy);
+  EXPECT_TRUE(copy.empty());
+  EXPECT_EQ(copy.begin<by_group>(), copy.end<by_group>());
+  moved.swap(a);
+  EXPECT_EQ(moved.size(), 2);
+  EXPECT_EQ(ids<by_group>(a), (std::vector<int>{3, 2, 1}));
+  a.clear();
+  EXPECT_EQ(a.begin<by_name>(), a.end<by_name>());
+}
+
+TEST(multi_index, random_against_model) {
+  std::mt19937 e(seed);
+  multi_index<std::pair<int, int>,
+              intrusive_map::index_by<by_id, &std::pair<int, int>::first>,
+              intrusive_map::non_unique_index_by<
+                  by_group, &std::pair<int, int>::second>>
+      m;
+  std::map<int, int> model;
+  for (int i = 0; i < 20000; i++) {
+    int key = static_cast<int>(e() % 500);
+    int group = static_cast<int>(e() % 20);
+    if (e() % 3 == 0) {
+      EXPECT_EQ(m.erase<by_id>(key), model.erase(key));
+    } else {
+      bool inserted = model.emplace(key, group).second;
+      EXPECT_EQ(m.insert({key, group}) != m.end<by_id>(), inserted);
+    }
+  }
+  ASSERT_EQ(m.size(), model.size());
+  auto it = m.begin<by_id>();
+  for (auto const& [key, group] : model) {
+    EXPECT_EQ(it->first, key);
+    EXPECT_EQ(it->second, group);
+    ++it;
+  }
+  std::size_t n = 0;
+  for (auto g = m.begin<by_group>(); g != m.end<by_group>(); ++n) {
+    auto next = std::next(g);
+    if (next != m.end<by_group>()) {
+      EXPECT_LE(g->second, next->second);
+    }
+    EXPECT_EQ(model.at(g->first), g->second);
+    g = next;
+  }
+  EXPECT_EQ(n, model.size());
+}
+
+struct reclaim_policy : intrusive_map::default_policy {
+  static constexpr std::size_t inline_capacity = 4;
+  using left_index = intrusive_map::radix_index;
+  static constexpr std::size_t lru_capacity = 100000;
+  static constexpr bool compactable = true;
+  static constexpr std::size_t background_reclaim_threshold = 100;
+};
+
+#if !defined(_WIN32)
+namespace {
+// Выполняет f в отдельном потоке со стеком stack_size байт
+template <typename F>
+void run_with_stack(std::size_t stack_size, F f) {
+  pthread_attr_t attr;
+  ASSERT_EQ(pthread_attr_init(&attr), 0);
+  pthread_t thread;
+  auto body = [](void* arg) -> void* {
+    (*static_cast<F*>(arg))();
+    return nullptr;
+  };
+  int set = pthread_attr_setstacksize(&attr, stack_size);
+  int created = set == 0 ? pthread_create(&thread, &attr, body, &f) : -1;
+  pthread_attr_destroy(&attr);
+  ASSERT_EQ(set, 0);
+  ASSERT_EQ(created, 0);
+  pthread_join(thread, nullptr);
+}
+} // namespace
+#endif
+
+TEST(bimap, clear_and_background_reclaim) {
+  using reclaimed =
+      bimap<int, std::shared_ptr<int>, std::less<int>,
+            std::less<std::shared_ptr<int>>, reclaim_policy>;
+  auto& reclaimer = intrusive_map::background_reclaimer::instance();
+  std::vector<std::weak_ptr<int>> values;
+  auto fill = [&values](reclaimed& b, int n) {
+    for (int i = 0; i < n; i++) {
+      auto value = std::make_shared<int>(i);
+      values.push_back(value);
+      b.insert(i, std::move(value));
+    }
+  };
+  auto all_expired = [&values] {
+    return std::all_of(values.begin(), values.end(),
+                       [](auto const& w) { return w.expired(); });
+  };
+
+  // Маленькая bimap разбирается сразу
+  std::size_t completed = reclaimer.completed();
+  {
+    reclaimed b;
+    fill(b, 50);
+  }
+  EXPECT_TRUE(all_expired());
+
+  {
+    reclaimed b;
+    fill(b, 1000);
+    b.compact();
+    fill(b, 10);
+    b.clear();
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(b.begin_left(), b.end_left());
+    EXPECT_EQ(b.find_left(5), b.end_left());
+    b.insert(5, nullptr);
+    EXPECT_EQ(b.find_left(5).get_value(), nullptr);
+
+    reclaimed other;
+    fill(other, 500);
+    b = std::move(other);
+    EXPECT_EQ(b.size(), 500);
+    EXPECT_EQ(*b.find_left(499).get_value(), 499);
+  }
+  reclaimer.drain();
+  EXPECT_TRUE(all_expired());
+  EXPECT_EQ(reclaimer.completed(), completed + 2);
+
+#if !defined(_WIN32)
+  // Вырожденное дерево разбирается без рекурсии: clear и деструктор идут в
+  // потоке с маленьким стеком, которого не хватило бы на рекурсивный спуск
+  // по цепочке
+  std::optional<bimap<int, int>> chain(std::in_place);
+  std::optional<bimap<int, int>> doomed(std::in_place);
+  for (int i = 0; i < 4000; i++) {
+    chain->insert(i, i);
+    doomed->insert(-i, i);
+  }
+  EXPECT_EQ(chain->height_left(), 4000);
+  EXPECT_EQ(doomed->height_left(), 4000);
+  run_with_stack(64 * 1024, [&] {
+    chain->clear();
+    doomed.reset();
+  });
+  EXPECT_EQ(chain->size(), 0);
+  chain->insert(1, 1);
+  EXPECT_EQ(chain->size(), 1);
+#endif
+}
+
+enum class opcode { add, sub, mul, div };
+
+constexpr auto mnemonics = make_static_bimap<opcode, std::string_view>(
+    {{opcode::mul, "mul"},
+     {opcode::add, "add"},
+     {opcode::div, "div"},
+     {opcode::sub, "sub"}});
+
+static_assert(mnemonics.at_left(opcode::div) == "div");
+static_assert(mnemonics.at_right("sub") == opcode::sub);
+static_assert(mnemonics.find_right("mov") == mnemonics.end());
+static_assert(mnemonics.begin()->first == opcode::add);
+
+TEST(bimap, static_bimap) {
+  std::string_view names[] = {"add", "sub", "mul", "div"};
+  for (std::string_view name : names) {
+    EXPECT_EQ(mnemonics.at_left(mnemonics.at_right(name)), name);
+  }
+  EXPECT_THROW(mnemonics.at_right(std::string("nop")), std::out_of_range);
+
+  constexpr auto reversed =
+      static_bimap<int, int, 3, std::greater<int>>({{1, 30}, {2, 20}, {3, 10}});
+  std::vector<int> lefts;
+  for (auto const& [left, right] : reversed) {
+    lefts.push_back(left);
+  }
+  EXPECT_EQ(lefts, (std::vector<int>{3, 2, 1}));
+  EXPECT_EQ(reversed.find_left(4), reversed.end());
+  EXPECT_EQ(reversed.at_right(20), 2);
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T>& lefts, std::vector<T>& rights, std::mt19937& e) {
@@ -418,8 +2006,6 @@ eliminate_same(std::vector<T>& lefts, std::vector<T>& rights, std::mt19937& e) {
 template struct bimap<int, non_default_constructible>;
 template struct bimap<non_default_constructible, int>;
 
-static constexpr uint32_t seed = 1488228;
-
 TEST(bimap_randomized, comparison) {
   std::cout << "Seed used for randomized compare test is " << seed << std::endl;
 
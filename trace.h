@@ -0,0 +1,300 @@
+#pragma once
+
+#include "bimap.h"
+#include "journal.h"
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace intrusive_map {
+// Трасса обращений к bimap для воспроизведения реальной нагрузки в
+// bimap_replay. Формат: заголовок trace_magic, байт версии, байт
+// trace_keys и теги типов left и right ('i' — знаковое целое, 'u' —
+// беззнаковое, 's' — std::string, 'h' — 64-битный std::hash ключа).
+// Дальше записи: байт trace_op, ключи в journal_codec и у scan — число
+// шагов
+enum class trace_op : unsigned char {
+  insert = 1,        // left, right
+  erase_left = 2,    // left
+  erase_right = 3,   // right
+  find_left = 4,     // left
+  find_right = 5,    // right
+  at_left = 6,       // left
+  at_right = 7,      // right
+  lower_bound_left = 8,
+  upper_bound_left = 9,
+  lower_bound_right = 10,
+  upper_bound_right = 11,
+  scan_left = 12,    // left, шаги от lower_bound_left
+  scan_right = 13    // right, шаги от lower_bound_right
+};
+
+// hashed прячет ключи: трасса сохраняет повторы и частоты обращений, но
+// не порядок ключей, так что bound и scan при воспроизведении попадают в
+// случайные места
+enum class trace_keys : unsigned char { raw, hashed };
+
+inline constexpr std::string_view trace_magic = "BMTR";
+inline constexpr unsigned char trace_version = 1;
+
+template <typename Key>
+constexpr char trace_tag() {
+  if constexpr (std::signed_integral<Key>) {
+    return 'i';
+  } else if constexpr (std::unsigned_integral<Key>) {
+    return 'u';
+  } else {
+    static_assert(std::is_same_v<Key, std::string>,
+                  "raw trace keys must be integers or std::string");
+    return 's';
+  }
+}
+
+struct trace_header {
+  trace_keys keys;
+  char left_tag;
+  char right_tag;
+};
+
+// Разбирает заголовок и сдвигает in на первую запись
+inline trace_header read_trace_header(std::string_view& in) {
+  std::size_t size = trace_magic.size() + 4;
+  if (in.size() < size || in.substr(0, trace_magic.size()) != trace_magic) {
+    throw std::invalid_argument("not a bimap trace");
+  }
+  if (static_cast<unsigned char>(in[trace_magic.size()]) != trace_version) {
+    throw std::invalid_argument("unsupported trace version");
+  }
+  trace_header header{static_cast<trace_keys>(in[trace_magic.size() + 1]),
+                      in[trace_magic.size() + 2], in[trace_magic.size() + 3]};
+  in.remove_prefix(size);
+  return header;
+}
+
+template <typename Left, typename Right>
+struct trace_record {
+  trace_op op{};
+  Left left{};
+  Right right{};
+  std::size_t steps{0};
+};
+
+// Читает следующую запись, false — трасса кончилась. Left и Right должны
+// соответствовать тегам заголовка: std::int64_t для 'i', std::uint64_t для
+// 'u' и 'h', std::string для 's'
+template <typename Left, typename Right>
+bool read_trace_record(std::string_view& in, trace_record<Left, Right>& rec) {
+  if (in.empty()) {
+    return false;
+  }
+  rec.op = static_cast<trace_op>(in.front());
+  in.remove_prefix(1);
+  switch (rec.op) {
+  case trace_op::insert:
+    rec.left = journal_codec<Left>::decode(in);
+    rec.right = journal_codec<Right>::decode(in);
+    break;
+  case trace_op::erase_left:
+  case trace_op::find_left:
+  case trace_op::at_left:
+  case trace_op::lower_bound_left:
+  case trace_op::upper_bound_left:
+    rec.left = journal_codec<Left>::decode(in);
+    break;
+  case trace_op::erase_right:
+  case trace_op::find_right:
+  case trace_op::at_right:
+  case trace_op::lower_bound_right:
+  case trace_op::upper_bound_right:
+    rec.right = journal_codec<Right>::decode(in);
+    break;
+  case trace_op::scan_left:
+    rec.left = journal_codec<Left>::decode(in);
+    rec.steps = journal_codec<std::size_t>::decode(in);
+    break;
+  case trace_op::scan_right:
+    rec.right = journal_codec<Right>::decode(in);
+    rec.steps = journal_codec<std::size_t>::decode(in);
+    break;
+  default:
+    throw std::invalid_argument("unknown trace record");
+  }
+  return true;
+}
+} // namespace intrusive_map
+
+// Обертка над bimap, которая пишет каждое обращение в трассу (см.
+// intrusive_map::trace_op). Запись идет прямо в out, буферизацию дает сам
+// поток, например std::ofstream. Начинает с пустой bimap, чтобы трасса
+// воспроизводилась с нуля
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename Policy = intrusive_map::default_policy>
+class traced_bimap {
+  using bimap_t = bimap<Left, Right, CompareLeft, CompareRight, Policy>;
+  using trace_op = intrusive_map::trace_op;
+
+public:
+  using left_iterator = typename bimap_t::left_iterator;
+  using right_iterator = typename bimap_t::right_iterator;
+
+  explicit traced_bimap(std::ostream& out,
+                        intrusive_map::trace_keys keys =
+                            intrusive_map::trace_keys::raw,
+                        CompareLeft compare_left = CompareLeft(),
+                        CompareRight compare_right = CompareRight())
+      : bimap_(std::move(compare_left), std::move(compare_right)), out_(out),
+        keys_(keys) {
+    buffer_.append(intrusive_map::trace_magic);
+    buffer_.push_back(static_cast<char>(intrusive_map::trace_version));
+    buffer_.push_back(static_cast<char>(keys));
+    buffer_.push_back(tag<Left>());
+    buffer_.push_back(tag<Right>());
+    flush_record();
+  }
+
+  traced_bimap(traced_bimap const&) = delete;
+  traced_bimap& operator=(traced_bimap const&) = delete;
+
+  left_iterator insert(Left const& left, Right const& right) {
+    start(trace_op::insert);
+    key(left);
+    key(right);
+    flush_record();
+    return bimap_.insert(left, right);
+  }
+  bool erase_left(Left const& left) {
+    record(trace_op::erase_left, left);
+    return bimap_.erase_left(left);
+  }
+  bool erase_right(Right const& right) {
+    record(trace_op::erase_right, right);
+    return bimap_.erase_right(right);
+  }
+  left_iterator find_left(Left const& left) {
+    record(trace_op::find_left, left);
+    return bimap_.find_left(left);
+  }
+  right_iterator find_right(Right const& right) {
+    record(trace_op::find_right, right);
+    return bimap_.find_right(right);
+  }
+  Right const& at_left(Left const& left) {
+    record(trace_op::at_left, left);
+    return bimap_.at_left(left);
+  }
+  Left const& at_right(Right const& right) {
+    record(trace_op::at_right, right);
+    return bimap_.at_right(right);
+  }
+  left_iterator lower_bound_left(Left const& left) {
+    record(trace_op::lower_bound_left, left);
+    return bimap_.lower_bound_left(left);
+  }
+  left_iterator upper_bound_left(Left const& left) {
+    record(trace_op::upper_bound_left, left);
+    return bimap_.upper_bound_left(left);
+  }
+  right_iterator lower_bound_right(Right const& right) {
+    record(trace_op::lower_bound_right, right);
+    return bimap_.lower_bound_right(right);
+  }
+  right_iterator upper_bound_right(Right const& right) {
+    record(trace_op::upper_bound_right, right);
+    return bimap_.upper_bound_right(right);
+  }
+
+  // Обход: f(left, right) для не более чем steps пар, начиная с
+  // lower_bound_left(from). Возвращает число посещенных пар
+  template <typename F>
+  std::size_t scan_left(Left const& from, std::size_t steps, F f) {
+    record(trace_op::scan_left, from, steps);
+    std::size_t n = 0;
+    for (left_iterator it = bimap_.lower_bound_left(from);
+         n < steps && it != bimap_.end_left(); ++it, ++n) {
+      f(*it, it.get_value());
+    }
+    return n;
+  }
+  // f(right, left) начиная с lower_bound_right(from)
+  template <typename F>
+  std::size_t scan_right(Right const& from, std::size_t steps, F f) {
+    record(trace_op::scan_right, from, steps);
+    std::size_t n = 0;
+    for (right_iterator it = bimap_.lower_bound_right(from);
+         n < steps && it != bimap_.end_right(); ++it, ++n) {
+      f(*it, it.get_value());
+    }
+    return n;
+  }
+
+  std::size_t size() const {
+    return bimap_.size();
+  }
+  // Нетрассируемый доступ, например к end_left()
+  bimap_t const& underlying() const {
+    return bimap_;
+  }
+
+private:
+  // Ключи других типов пишутся хешами и в режиме raw
+  template <typename Key>
+  static constexpr bool raw_key =
+      std::is_same_v<Key, std::string> || std::is_integral_v<Key>;
+
+  template <typename Key>
+  char tag() const {
+    if constexpr (raw_key<Key>) {
+      if (keys_ == intrusive_map::trace_keys::raw) {
+        return intrusive_map::trace_tag<Key>();
+      }
+    }
+    return 'h';
+  }
+
+  void start(trace_op op) {
+    buffer_.push_back(static_cast<char>(op));
+  }
+
+  template <typename Key>
+  void key(Key const& k) {
+    if constexpr (raw_key<Key>) {
+      if (keys_ == intrusive_map::trace_keys::raw) {
+        intrusive_map::journal_codec<Key>::encode(k, buffer_);
+        return;
+      }
+    }
+    intrusive_map::journal_codec<std::uint64_t>::encode(std::hash<Key>()(k),
+                                                        buffer_);
+  }
+
+  template <typename Key>
+  void record(trace_op op, Key const& k) {
+    start(op);
+    key(k);
+    flush_record();
+  }
+  template <typename Key>
+  void record(trace_op op, Key const& k, std::size_t steps) {
+    start(op);
+    key(k);
+    intrusive_map::journal_codec<std::size_t>::encode(steps, buffer_);
+    flush_record();
+  }
+
+  void flush_record() {
+    out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    buffer_.clear();
+  }
+
+  bimap_t bimap_;
+  std::ostream& out_;
+  intrusive_map::trace_keys keys_;
+  std::string buffer_;
+};